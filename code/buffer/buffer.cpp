@@ -1,44 +1,117 @@
 #include "buffer.h"
 
-// 读写下标初始化，vector<char>初始化
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0)  {}  
+// 读写下标初始化，vector<char>初始化；分段模式在写入时才分配块
+Buffer::Buffer(int initBuffSize, bool segmented) : segmented_(segmented), buffer_(segmented ? 0 : initBuffSize),
+        readPos_(0), writePos_(0), readable_(0) {}
+
+Buffer::~Buffer() {
+    for(Slab* slab : slabs_) { BufferArena::Put(slab); }
+}
 
 // 可写的数量：buffer大小 - 写下标
 size_t Buffer::WritableBytes() const {
+    if(segmented_) {
+        return slabs_.empty() ? 0 : slabs_.back()->cap - slabs_.back()->write;
+    }
     return buffer_.size() - writePos_;
 }
 
 // 可读的数量：写下标 - 读下标
 size_t Buffer::ReadableBytes() const {
-    return writePos_ - readPos_;
+    return segmented_ ? readable_ : writePos_ - readPos_;
 }
 
 // 可预留空间：已经读过的就没用了，等于读下标
 size_t Buffer::PrependableBytes() const {
+    if(segmented_) {
+        return slabs_.empty() ? 0 : slabs_.front()->read;
+    }
     return readPos_;
 }
 
+size_t Buffer::ContiguousBytes() const {
+    if(segmented_) {
+        return slabs_.empty() ? 0 : slabs_.front()->write - slabs_.front()->read;
+    }
+    return ReadableBytes();
+}
+
 // 返回一个指向缓冲区中可读数据的指针，即读下标 readPos_ 的位置。
 const char* Buffer::Peek() const {
-    
+    if(segmented_) {
+        return slabs_.empty() ? "" : slabs_.front()->Data() + slabs_.front()->read;
+    }
     return &buffer_[readPos_];
 }
 
+// 前len字节跨了块：拷贝到一个足够大的新块里放在最前面，取空的块还回去
+const char* Buffer::Pullup(size_t len) {
+    assert(len <= ReadableBytes());
+    if(ContiguousBytes() >= len) {
+        return Peek();
+    }
+    Slab* merged = BufferArena::Get(len);
+    while(merged->write < len) {
+        Slab* front = slabs_.front();
+        size_t n = std::min(front->write - front->read, len - merged->write);
+        memcpy(merged->Data() + merged->write, front->Data() + front->read, n);
+        merged->write += n;
+        front->read += n;
+        if(front->read == front->write) {
+            BufferArena::Put(front);
+            slabs_.erase(slabs_.begin());
+        }
+    }
+    slabs_.insert(slabs_.begin(), merged);
+    return Peek();
+}
+
 // 确保缓冲区中有足够的写空间存储len字节的数据。若不足则调用MakeSpace_函数扩展缓冲区大小
+// 分段模式下在末尾接一个至少len字节的新块，原来最后一块剩下的空间不再使用
 void Buffer::EnsureWriteable(size_t len) {
     if(len > WritableBytes()) {
-        MakeSpace_(len);
+        if(segmented_) {
+            if(!slabs_.empty() && slabs_.back()->read == slabs_.back()->write) {
+                BufferArena::Put(slabs_.back());   // 空块，换一个够大的
+                slabs_.pop_back();
+            }
+            slabs_.push_back(BufferArena::Get(len));
+        } else {
+            MakeSpace_(len);
+        }
     }
     assert(len <= WritableBytes());
 }
 
 // 移动写下标，表示已经写入了len字节的数据。在Append中使用
 void Buffer::HasWritten(size_t len) {
+    if(segmented_) {
+        assert(len <= WritableBytes());
+        slabs_.back()->write += len;
+        readable_ += len;
+        return;
+    }
     writePos_ += len;
 }
 
-// 移动读下标，表示已经读取了len字节的数据
+// 移动读下标，表示已经读取了len字节的数据；分段模式下读完的块还回空闲链表
 void Buffer::Retrieve(size_t len) {
+    if(segmented_) {
+        assert(len <= readable_);
+        readable_ -= len;
+        while(len > 0) {
+            Slab* front = slabs_.front();
+            size_t avail = front->write - front->read;
+            if(len < avail) {
+                front->read += len;
+                break;
+            }
+            len -= avail;
+            BufferArena::Put(front);
+            slabs_.erase(slabs_.begin());
+        }
+        return;
+    }
     readPos_ += len;
 }
 
@@ -48,31 +121,57 @@ void Buffer::RetrieveUntil(const char* end) {
     Retrieve(end - Peek()); // end指针 - 读指针 长度
 }
 
-// 取出所有数据，buffer归零，读写下标归零,在别的函数中会用到
+// 取出所有数据，读写下标归零，在别的函数中会用到；旧数据不用清零，读写都以下标为界
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size()); // 覆盖原本数据
+    if(segmented_) {
+        for(Slab* slab : slabs_) { BufferArena::Put(slab); }
+        slabs_.clear();
+        readable_ = 0;
+        return;
+    }
     readPos_ = writePos_ = 0;
 }
 
 // 取出剩余可读的str，再将缓冲区清空
 std::string Buffer::RetrieveAllToStr() {
-    std::string str(Peek(), ReadableBytes());
+    std::string str;
+    str.reserve(ReadableBytes());
+    ForEachSpan(0, ReadableBytes(), [&str](const char* data, size_t len) { str.append(data, len); });
     RetrieveAll();
     return str;
 }
 
-// 写指针的位置
+// 写指针的位置，分段模式下为最后一块的写下标，先EnsureWriteable再用
 const char* Buffer::BeginWriteConst() const {
+    if(segmented_) {
+        return slabs_.empty() ? nullptr : slabs_.back()->Data() + slabs_.back()->write;
+    }
     return &buffer_[writePos_];
 }
 
 char* Buffer::BeginWrite() {
+    if(segmented_) {
+        return slabs_.empty() ? nullptr : slabs_.back()->Data() + slabs_.back()->write;
+    }
     return &buffer_[writePos_];
 }
 
-// 添加str到缓冲区
+// 添加str到缓冲区；分段模式下先填满最后一块，剩下的接新块，不搬动已有数据
 void Buffer::Append(const char* str, size_t len) {
-    assert(str);
+    assert(str || len == 0);
+    if(segmented_) {
+        while(len > 0) {
+            if(WritableBytes() == 0) {
+                slabs_.push_back(BufferArena::Get());
+            }
+            size_t n = std::min(len, WritableBytes());
+            memcpy(BeginWrite(), str, n);
+            HasWritten(n);
+            str += n;
+            len -= n;
+        }
+        return;
+    }
     EnsureWriteable(len);   // 确保可写的长度
     std::copy(str, str + len, BeginWrite());    // 将str放到写下标开始的地方
     HasWritten(len);    // 移动写下标
@@ -83,17 +182,57 @@ void Buffer::Append(const std::string& str) {
 }
 
 // 将二进制数据data中的len字节追加到缓冲区中
-void Append(const void* data, size_t len) {
+void Buffer::Append(const void* data, size_t len) {
     Append(static_cast<const char*>(data), len);
 }
 
 // 将buffer中的读下标的地方放到该buffer中的写下标位置
-void Append(const Buffer& buff) {
-    Append(buff.Peek(), buff.ReadableBytes());
+void Buffer::Append(const Buffer& buff) {
+    buff.ForEachSpan(0, buff.ReadableBytes(), [this](const char* data, size_t len) { Append(data, len); });
 }
 
 // 将fd的内容读到缓冲区，即writable的位置，并返回读取的字节数
+// 分段模式：最后一块的剩余空间加上几个新块，凑够READ_AHEAD一次readv，读到数据的块接到末尾，没用上的还回去
 ssize_t Buffer::ReadFd(int fd, int* Errno) {
+    if(segmented_) {
+        struct iovec iov[MAX_READ_IOV + 1];
+        Slab* fresh[MAX_READ_IOV];
+        int cnt = 0, freshCnt = 0;
+        size_t tailFree = WritableBytes();
+        size_t total = tailFree;
+        if(tailFree > 0) {
+            iov[cnt].iov_base = BeginWrite();
+            iov[cnt++].iov_len = tailFree;
+        }
+        while(total < READ_AHEAD && freshCnt < MAX_READ_IOV) {
+            Slab* slab = BufferArena::Get();
+            fresh[freshCnt++] = slab;
+            iov[cnt].iov_base = slab->Data();
+            iov[cnt++].iov_len = slab->cap;
+            total += slab->cap;
+        }
+        ssize_t len = readv(fd, iov, cnt);
+        if(len < 0) {
+            *Errno = errno;
+        }
+        size_t left = len > 0 ? static_cast<size_t>(len) : 0;
+        size_t n = std::min(left, tailFree);
+        if(n > 0) {
+            HasWritten(n);
+            left -= n;
+        }
+        for(int i = 0; i < freshCnt; i++) {
+            if(left > 0) {
+                fresh[i]->write = std::min(left, fresh[i]->cap);
+                left -= fresh[i]->write;
+                readable_ += fresh[i]->write;
+                slabs_.push_back(fresh[i]);
+            } else {
+                BufferArena::Put(fresh[i]);
+            }
+        }
+        return len;
+    }
     char buff[65535];   // 栈区
     struct iovec iov[2];
     size_t writeable = WritableBytes(); // 先记录能写多少
@@ -115,9 +254,21 @@ ssize_t Buffer::ReadFd(int fd, int* Errno) {
     return len;
 }
 
-// 将buffer中可读的区域写入fd中
+// 将buffer中可读的区域写入fd中，分段模式下各块一次writev
 ssize_t Buffer::WriteFd(int fd, int* Errno) {
-    ssize_t len = write(fd, Peek(), ReadableBytes());
+    ssize_t len;
+    if(segmented_) {
+        struct iovec iov[IOV_MAX_WRITE];
+        int cnt = 0;
+        for(size_t i = 0; i < slabs_.size() && cnt < IOV_MAX_WRITE; i++) {
+            iov[cnt].iov_base = slabs_[i]->Data() + slabs_[i]->read;
+            iov[cnt].iov_len = slabs_[i]->write - slabs_[i]->read;
+            cnt++;
+        }
+        len = writev(fd, iov, cnt);
+    } else {
+        len = write(fd, Peek(), ReadableBytes());
+    }
     if(len < 0) {
         *Errno = errno;
         return len;
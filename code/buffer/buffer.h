@@ -5,22 +5,39 @@
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
 #include <vector> //readv
+#include <algorithm>
 #include <atomic>
 #include <assert.h>
+
+#include "bufferarena.h"
+
+/*
+连续模式：一个vector<char>，空间不够时整理或扩容，日志等需要一整块可写空间的场合使用
+分段模式：一串从BufferArena取的Slab，追加时在末尾接新块，已有数据不搬动；ReadFd用readv直接读进块里，
+ForEachSpan把任意一段数据按块拆开，连接直接拿去writev；构造时不分配，数据取完后块立刻还给BufferArena
+两种模式接口相同；分段模式下Peek()之后只有ContiguousBytes()字节是连续的，需要更长的连续数据时用Pullup
+*/
 class Buffer {
 public:
-    Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    Buffer(int initBuffSize = 1024, bool segmented = false);
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
-    // 可写的数量：buffer大小 - 写下标
+    // 可写的数量：buffer大小 - 写下标（分段模式下为最后一块的剩余空间）
     size_t WritableBytes() const;
-    // 可读的数量：写下标 - 读下标 
+    // 可读的数量：写下标 - 读下标
     size_t ReadableBytes() const ;
     // 可预留的空间：已读过的就没用了，等于读下标
     size_t PrependableBytes() const;
+    // Peek()开始连续可读的字节数，连续模式下等于ReadableBytes()
+    size_t ContiguousBytes() const;
 
     // 读下标的位置
     const char* Peek() const;
+    // 让前len个可读字节连续（分段模式下跨块时拷贝到一个新块），返回Peek()
+    const char* Pullup(size_t len);
     // 确保缓冲区中有足够的可写空间
     void EnsureWriteable(size_t len);
     void HasWritten(size_t len);
@@ -42,6 +59,28 @@ public:
     ssize_t ReadFd(int fd, int* Errno);
     ssize_t WriteFd(int fd, int* Errno);
 
+    // 把可读数据中[offset, offset+len)按连续的内存段依次交给f(const char* data, size_t len)
+    template<typename F>
+    void ForEachSpan(size_t offset, size_t len, F f) const {
+        assert(offset + len <= ReadableBytes());
+        if(!segmented_) {
+            if(len > 0) { f(Peek() + offset, len); }
+            return;
+        }
+        for(const Slab* slab : slabs_) {
+            if(len == 0) { break; }
+            size_t avail = slab->write - slab->read;
+            if(offset >= avail) {
+                offset -= avail;
+                continue;
+            }
+            size_t n = std::min(avail - offset, len);
+            f(slab->Data() + slab->read + offset, n);
+            offset = 0;
+            len -= n;
+        }
+    }
+
 private:
     char* BeginPtr_();  // buffer开头
     // 返回缓冲区的起始地址
@@ -51,9 +90,17 @@ private:
     //! 用什么方式分配足够的内存来保存数据
     //MakeSpace()扩容，创建一个更大的vector<char>，将旧数据移动到新容器中，并释放旧的vector
 
-    std::vector<char> buffer_;  
+    static const size_t READ_AHEAD = 65536;     // 分段模式下一次readv最多读入的字节数
+    static const int MAX_READ_IOV = READ_AHEAD / Slab::SIZE + 1;
+    static const int IOV_MAX_WRITE = 64;        // 分段模式下WriteFd一次最多写出的块数
+
+    bool segmented_;
+    std::vector<char> buffer_;
     std::atomic<std::size_t> readPos_;  // 读的下标
     std::atomic<std::size_t> writePos_; // 写的下标
+
+    std::vector<Slab*> slabs_;  // 分段模式：第一块是读的位置，最后一块是写的位置
+    size_t readable_;           // 分段模式：所有块里可读字节数之和
 };
 
-#endif //BUFFER_H
\ No newline at end of file
+#endif //BUFFER_H
@@ -0,0 +1,55 @@
+#include "bufferarena.h"
+#include <algorithm>
+
+std::atomic<size_t> BufferArena::inUse_(0);
+std::atomic<size_t> BufferArena::highWater_(0);
+std::atomic<size_t> BufferArena::cached_(0);
+std::atomic<uint64_t> BufferArena::allocs_(0);
+
+// 线程退出时把空闲块还给系统
+struct BufferArena::LocalCache_ {
+    std::vector<Slab*> slabs;
+    ~LocalCache_() {
+        for(Slab* slab : slabs) { ::operator delete(slab); }
+        cached_.fetch_sub(slabs.size() * Slab::SIZE, std::memory_order_relaxed);
+    }
+};
+thread_local BufferArena::LocalCache_ BufferArena::local_;
+
+Slab* BufferArena::Get(size_t cap) {
+    Slab* slab;
+    if(cap <= Slab::SIZE && !local_.slabs.empty()) {
+        slab = local_.slabs.back();
+        local_.slabs.pop_back();
+        cached_.fetch_sub(Slab::SIZE, std::memory_order_relaxed);
+    } else {
+        cap = std::max(cap, Slab::SIZE);
+        slab = static_cast<Slab*>(::operator new(sizeof(Slab) + cap));
+        slab->cap = cap;
+        allocs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    slab->read = slab->write = 0;
+    size_t used = inUse_.fetch_add(slab->cap, std::memory_order_relaxed) + slab->cap;
+    size_t high = highWater_.load(std::memory_order_relaxed);
+    while(used > high && !highWater_.compare_exchange_weak(high, used, std::memory_order_relaxed)) {}
+    return slab;
+}
+
+void BufferArena::Put(Slab* slab) {
+    inUse_.fetch_sub(slab->cap, std::memory_order_relaxed);
+    if(slab->cap == Slab::SIZE && local_.slabs.size() < MAX_CACHED) {
+        local_.slabs.push_back(slab);
+        cached_.fetch_add(Slab::SIZE, std::memory_order_relaxed);
+    } else {
+        ::operator delete(slab);
+    }
+}
+
+BufferArena::Stats BufferArena::GetStats() {
+    Stats stats;
+    stats.inUse = inUse_.load(std::memory_order_relaxed);
+    stats.highWater = highWater_.load(std::memory_order_relaxed);
+    stats.cached = cached_.load(std::memory_order_relaxed);
+    stats.allocs = allocs_.load(std::memory_order_relaxed);
+    return stats;
+}
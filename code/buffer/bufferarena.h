@@ -0,0 +1,53 @@
+#ifndef BUFFER_ARENA_H
+#define BUFFER_ARENA_H
+
+#include <atomic>
+#include <vector>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+// 分段缓冲区的存储单元：固定大小的内存块，头部后面紧跟着数据
+struct Slab {
+    static constexpr size_t SIZE = 4096;    // constexpr：std::max按引用取参数，不需要类外定义
+
+    size_t cap;
+    size_t read;    // 读下标
+    size_t write;   // 写下标
+    char* Data() { return reinterpret_cast<char*>(this + 1); }
+    const char* Data() const { return reinterpret_cast<const char*>(this + 1); }
+};
+
+/*
+缓冲区内存池：每个线程一条空闲块链表，取块、还块都只碰本线程的链表，不加锁
+块可以在一个线程取、另一个线程还（连接的读写会在不同的工作线程上进行），还到哪个线程就进哪个线程的链表
+每个线程最多留MAX_CACHED个空闲块，多的还给系统；超过Slab::SIZE的大块（Pullup等）不缓存
+连接只在请求处理期间持有块，空闲的keep-alive连接不占缓冲区内存；
+全局统计正在使用的字节数和它的历史最高值，用来估算并发连接的缓冲区内存
+*/
+class BufferArena {
+public:
+    struct Stats {
+        size_t inUse;       // 缓冲区正在持有的字节数
+        size_t highWater;   // inUse的历史最高值
+        size_t cached;      // 各线程空闲链表里的字节数
+        uint64_t allocs;    // 向系统申请的次数
+    };
+
+    static Slab* Get(size_t cap = Slab::SIZE);  // 返回的块读写下标为0，容量至少为cap
+    static void Put(Slab* slab);
+    static Stats GetStats();
+
+    static const size_t MAX_CACHED = 256;   // 每个线程最多留着的空闲块数（1MB）
+
+private:
+    struct LocalCache_;
+    static thread_local LocalCache_ local_;    // 本线程的空闲块
+
+    static std::atomic<size_t> inUse_;
+    static std::atomic<size_t> highWater_;
+    static std::atomic<size_t> cached_;
+    static std::atomic<uint64_t> allocs_;
+};
+
+#endif //BUFFER_ARENA_H
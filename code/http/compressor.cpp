@@ -0,0 +1,67 @@
+#include "compressor.h"
+
+using namespace std;
+
+const char* Compressor::Name(ENCODING enc) {
+    switch(enc) {
+        case GZIP:      return "gzip";
+        case BROTLI:    return "br";
+        default:        return "identity";
+    }
+}
+
+const char* Compressor::Suffix(ENCODING enc) {
+    switch(enc) {
+        case GZIP:      return ".gz";
+        case BROTLI:    return ".br";
+        default:        return "";
+    }
+}
+
+bool Compressor::Compressible(const string& mime) {
+    return mime.compare(0, 5, "text/") == 0 ||
+           mime == "application/xhtml+xml" ||
+           mime == "application/rtf";
+}
+
+bool Compressor::Compress(ENCODING enc, const char* data, size_t len, string* out) {
+    if(len < MIN_SIZE) { return false; }
+    bool ok = false;
+    if(enc == GZIP) {
+        ok = Gzip_(data, len, out);
+    } else if(enc == BROTLI) {
+        ok = Brotli_(data, len, out);
+    }
+    return ok && out->size() < len;     // 压不小就发原文件
+}
+
+bool Compressor::Gzip_(const char* data, size_t len, string* out) {
+    z_stream zs = {};
+    // windowBits加16生成gzip格式而不是zlib格式
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out->resize(deflateBound(&zs, len));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in = len;
+    zs.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+    zs.avail_out = out->size();
+    int ret = deflate(&zs, Z_FINISH);
+    out->resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+bool Compressor::Brotli_(const char* data, size_t len, string* out) {
+    size_t outLen = BrotliEncoderMaxCompressedSize(len);
+    if(outLen == 0) { return false; }
+    out->resize(outLen);
+    // 只压缩一次然后缓存，可以用较高的质量；11太慢，大的js要上百毫秒
+    if(!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                              reinterpret_cast<const uint8_t*>(data), &outLen,
+                              reinterpret_cast<uint8_t*>(&(*out)[0]))) {
+        return false;
+    }
+    out->resize(outLen);
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <string>
+#include <zlib.h>               // gzip
+#include <brotli/encode.h>      // br
+
+/*
+静态资源的内容编码：判断哪些类型值得压缩，并用zlib/brotli压缩一整块数据
+压缩结果由FileCache缓存，每个文件只压缩一次
+*/
+class Compressor {
+public:
+    enum ENCODING {
+        IDENTITY = 0,
+        GZIP,
+        BROTLI,
+    };
+
+    static const char* Name(ENCODING enc);      // Content-Encoding中的名字
+    static const char* Suffix(ENCODING enc);    // 预压缩文件的后缀，如.gz
+
+    static bool Compressible(const std::string& mime);  // 文本类资源才压缩，图片、压缩包等本身已经压缩过
+    static bool Compress(ENCODING enc, const char* data, size_t len, std::string* out);
+
+    static const size_t MIN_SIZE = 256;     // 太小的文件压缩后省不了多少，不压缩
+
+private:
+    static bool Gzip_(const char* data, size_t len, std::string* out);
+    static bool Brotli_(const char* data, size_t len, std::string* out);
+};
+
+#endif //COMPRESSOR_H
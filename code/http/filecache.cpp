@@ -0,0 +1,321 @@
+#include "filecache.h"
+#include "httpresponse.h"
+
+using namespace std;
+
+FileCache::FileCache() : isOpen_(false), maxEntries_(0), maxBytes_(0), mmapLimit_(SIZE_MAX), inotifyFd_(-1), stopFd_(-1) {}
+
+FileCache::~FileCache() {
+    Close();
+}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+void FileCache::Init(const string& root, size_t maxEntries, size_t maxBytes, size_t mmapLimit) {
+    assert(!isOpen_);
+    mmapLimit_ = mmapLimit;
+    if(maxEntries == 0 || maxBytes == 0) { return; }   // 不启用缓存
+    maxEntries_ = max<size_t>(1, maxEntries / SHARD_NUM);
+    maxBytes_ = max<size_t>(1, maxBytes / SHARD_NUM);
+
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(inotifyFd_ < 0 || stopFd_ < 0) {
+        // 没有inotify就无法得知文件变化，宁可不缓存
+        LOG_ERROR("FileCache inotify init error!");
+        if(inotifyFd_ >= 0) { close(inotifyFd_); inotifyFd_ = -1; }
+        if(stopFd_ >= 0) { close(stopFd_); stopFd_ = -1; }
+        return;
+    }
+    AddWatch_(Normalize_(root));
+    isOpen_ = true;
+    watchThread_ = thread(&FileCache::WatchThread_, this);
+    LOG_INFO("FileCache entries: %d, bytes: %d, mmap limit: %d", (int)maxEntries, (int)maxBytes, (int)mmapLimit);
+}
+
+void FileCache::Close() {
+    if(!isOpen_) { return; }
+    isOpen_ = false;
+    uint64_t one = 1;
+    ssize_t ret = write(stopFd_, &one, sizeof(one));
+    (void)ret;
+    if(watchThread_.joinable()) { watchThread_.join(); }
+    close(inotifyFd_);
+    close(stopFd_);
+    inotifyFd_ = stopFd_ = -1;
+    watchDirs_.clear();
+    Clear();
+}
+
+// 去掉重复的'/'（srcDir以'/'结尾，path以'/'开头），和inotify给出的路径保持一致
+string FileCache::Normalize_(const string& path) {
+    string key;
+    key.reserve(path.size());
+    for(char ch : path) {
+        if(ch == '/' && !key.empty() && key.back() == '/') { continue; }
+        key.push_back(ch);
+    }
+    if(key.size() > 1 && key.back() == '/') { key.pop_back(); }
+    return key;
+}
+
+FileCache::Shard& FileCache::ShardOf_(const string& key) {
+    return shards_[hash<string>()(key) % SHARD_NUM];
+}
+
+// 打开并映射文件，不放入缓存
+shared_ptr<CachedFile> FileCache::Open_(const string& path) const {
+    int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return nullptr; }
+    shared_ptr<CachedFile> file = make_shared<CachedFile>();
+    file->fd = fd;
+    if(fstat(fd, &file->st) < 0 || !S_ISREG(file->st.st_mode) || !(file->st.st_mode & S_IROTH)) {
+        return nullptr;
+    }
+    if(file->st.st_size > 0 && static_cast<size_t>(file->st.st_size) <= mmapLimit_) {
+        //将文件映射到内存提高文件的访问速度  MAP_PRIVATE 建立一个写入时拷贝的私有映射
+        void* mmRet = mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mmRet == MAP_FAILED) { return nullptr; }
+        file->data = static_cast<char*>(mmRet);
+    }
+    file->mime = HttpResponse::FileType(path);
+    file->etag = HttpResponse::ETag(file->st);
+    file->lastModified = HttpResponse::HttpDate(file->st.st_mtime);
+    return file;
+}
+
+shared_ptr<const CachedFile> FileCache::Get(const string& path) {
+    if(!isOpen_) {
+        return Open_(path);
+    }
+    string key = Normalize_(path);
+    Shard& shard = ShardOf_(key);
+    uint64_t epoch;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.index.find(key);
+        if(it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);   // 移到表头
+            return it->second->second;
+        }
+        epoch = shard.epoch;
+    }
+    // 未命中，在锁外打开文件
+    return Insert_(key, Open_(key), epoch);
+}
+
+// 把未命中时打开的文件放入缓存，返回缓存中的那一份
+shared_ptr<const CachedFile> FileCache::Insert_(const string& key, shared_ptr<const CachedFile> file, uint64_t epoch) {
+    if(!file || Cost_(*file) > maxBytes_) {
+        return file;    // 太大的文件不缓存
+    }
+    Shard& shard = ShardOf_(key);
+    lock_guard<mutex> locker(shard.mtx);
+    if(shard.epoch != epoch) {  // 打开期间有文件失效，打开的可能是旧内容，这次不放入缓存
+        return file;
+    }
+    auto it = shard.index.find(key);
+    if(it != shard.index.end()) {   // 别的线程已经放进去了
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->second;
+    }
+    shard.lru.emplace_front(key, file);
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += Cost_(*file);
+    Evict_(shard);
+    return file;
+}
+
+shared_ptr<const CachedFile> FileCache::Lookup(const string& path) {
+    if(!isOpen_) {
+        return nullptr;
+    }
+    string key = Normalize_(path);
+    Shard& shard = ShardOf_(key);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(key);
+    if(it == shard.index.end()) {
+        return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->second;
+}
+
+shared_ptr<const CachedFile> FileCache::GetEncoded(const string& path, const CachedFile& origin, Compressor::ENCODING enc) {
+    string key = Normalize_(path);
+    if(!isOpen_) {
+        return Encode_(key, origin, enc);
+    }
+    uint64_t epoch;
+    shared_ptr<const CachedFile> cached = FindEncoded_(key, origin, enc, &epoch);
+    if(cached) {
+        return cached;
+    }
+    return Insert_(EncodedKey_(key, enc), Encode_(key, origin, enc), epoch);
+}
+
+shared_ptr<const CachedFile> FileCache::LookupEncoded(const string& path, const CachedFile& origin, Compressor::ENCODING enc) {
+    if(!isOpen_) {
+        return nullptr;
+    }
+    uint64_t epoch;
+    return FindEncoded_(Normalize_(path), origin, enc, &epoch);
+}
+
+// 在缓存中找压缩版本，没找到时通过epoch返回分片当前的失效计数
+shared_ptr<const CachedFile> FileCache::FindEncoded_(const string& key, const CachedFile& origin,
+                                                     Compressor::ENCODING enc, uint64_t* epoch) {
+    string encKey = EncodedKey_(key, enc);
+    Shard& shard = ShardOf_(encKey);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(encKey);
+    if(it != shard.index.end()) {
+        const CachedFile& cached = *it->second->second;
+        // 缓存的压缩结果属于旧版本的原文件（原文件刚被替换、失效事件还没到）时不用
+        if(cached.etag == HttpResponse::EncodedETag(origin.etag, enc)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->second;
+        }
+    }
+    *epoch = shard.epoch;
+    return nullptr;
+}
+
+// 找预压缩文件或者现场压缩，不放入缓存
+shared_ptr<CachedFile> FileCache::Encode_(const string& key, const CachedFile& origin, Compressor::ENCODING enc) const {
+    shared_ptr<CachedFile> file = Open_(key + Compressor::Suffix(enc));
+    if(file && (file->st.st_mtim.tv_sec < origin.st.st_mtim.tv_sec ||
+                (file->st.st_mtim.tv_sec == origin.st.st_mtim.tv_sec && file->st.st_mtim.tv_nsec < origin.st.st_mtim.tv_nsec))) {
+        file.reset();   // 预压缩文件比原文件旧，内容可能对不上
+    }
+    if(!file) {
+        // 没有缓存时每次请求都压缩太贵，只用预压缩文件
+        string out;
+        if(!isOpen_ || !origin.data || !Compressor::Compress(enc, origin.data, origin.st.st_size, &out)) {
+            return nullptr;
+        }
+        void* mem = mmap(0, out.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED) { return nullptr; }
+        memcpy(mem, out.data(), out.size());
+        file = make_shared<CachedFile>();
+        file->data = static_cast<char*>(mem);
+        file->st = origin.st;
+        file->st.st_size = out.size();
+    }
+    else if(!file->data) {
+        return nullptr;     // 超过mmap阈值的预压缩文件不用，连接只能sendfile原文件的fd
+    }
+    file->mime = origin.mime;
+    file->etag = HttpResponse::EncodedETag(origin.etag, enc);
+    file->lastModified = origin.lastModified;
+    return file;
+}
+
+// 按LRU淘汰，直到不超过预算，调用者需持有分片的锁
+void FileCache::Evict_(Shard& shard) {
+    while(!shard.lru.empty() && (shard.lru.size() > maxEntries_ || shard.bytes > maxBytes_)) {
+        auto& last = shard.lru.back();
+        shard.bytes -= Cost_(*last.second);
+        shard.index.erase(last.first);
+        shard.lru.pop_back();
+    }
+}
+
+// 使文件及由它得到的压缩版本失效；预压缩文件（.gz/.br）变化时使原文件的压缩版本失效
+void FileCache::Invalidate(const string& path) {
+    string key = Normalize_(path);
+    Erase_(key);
+    for(Compressor::ENCODING enc : { Compressor::GZIP, Compressor::BROTLI }) {
+        Erase_(EncodedKey_(key, enc));
+        string suffix = Compressor::Suffix(enc);
+        if(key.size() > suffix.size() && key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            Erase_(EncodedKey_(key.substr(0, key.size() - suffix.size()), enc));
+        }
+    }
+}
+
+void FileCache::Erase_(const string& key) {
+    Shard& shard = ShardOf_(key);
+    lock_guard<mutex> locker(shard.mtx);
+    shard.epoch++;
+    auto it = shard.index.find(key);
+    if(it == shard.index.end()) { return; }
+    shard.bytes -= Cost_(*it->second->second);
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+}
+
+void FileCache::Clear() {
+    for(auto& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        shard.index.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+        shard.epoch++;
+    }
+}
+
+// 监视目录及其所有子目录
+void FileCache::AddWatch_(const string& dir) {
+    int wd = inotify_add_watch(inotifyFd_, dir.data(),
+                IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if(wd < 0) {
+        LOG_WARN("FileCache watch %s error!", dir.data());
+        return;
+    }
+    watchDirs_[wd] = dir;
+    DIR* dp = opendir(dir.data());
+    if(!dp) { return; }
+    while(struct dirent* ent = readdir(dp)) {
+        if(ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+            AddWatch_(dir + "/" + ent->d_name);
+        }
+    }
+    closedir(dp);
+}
+
+void FileCache::WatchThread_() {
+    alignas(struct inotify_event) char buf[4096];
+    struct pollfd fds[2] = { { inotifyFd_, POLLIN, 0 }, { stopFd_, POLLIN, 0 } };
+    while(true) {
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR) { continue; }
+            break;
+        }
+        if(fds[1].revents) { break; }
+        ssize_t len;
+        while((len = read(inotifyFd_, buf, sizeof(buf))) > 0) {
+            for(char* p = buf; p < buf + len; ) {
+                struct inotify_event* ev = reinterpret_cast<struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + ev->len;
+                if(ev->mask & IN_Q_OVERFLOW) {  // 丢了事件，只能全部失效
+                    Clear();
+                    continue;
+                }
+                auto it = watchDirs_.find(ev->wd);
+                if(it == watchDirs_.end()) { continue; }
+                if(ev->mask & IN_IGNORED) {
+                    watchDirs_.erase(it);
+                    continue;
+                }
+                if(ev->len == 0) { continue; }  // 目录自身的事件
+                string path = it->second + "/" + ev->name;
+                if(ev->mask & IN_ISDIR) {
+                    if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                        AddWatch_(path);
+                    }
+                    // 目录被删除或改名，其下的条目无法逐个定位，全部失效
+                    if(ev->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+                        Clear();
+                    }
+                } else {
+                    Invalidate(path);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>       // stat
+#include <sys/mman.h>       // mmap, munmap
+#include <sys/inotify.h>    // inotify
+#include <sys/eventfd.h>    // eventfd
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "../log/log.h"
+#include "compressor.h"
+
+// 一个打开并映射好的静态文件，最后一个引用（缓存或正在发送的响应）释放时解除映射并关闭fd
+struct CachedFile {
+    int fd = -1;
+    struct stat st;
+    char* data = nullptr;   // 空文件或超过mmap阈值（用sendfile发送）的文件为nullptr；压缩结果放在匿名映射中，fd为-1
+    std::string mime;       // Content-type
+    std::string etag;       // 强ETag和Last-Modified，打开时算好，命中缓存时直接用
+    std::string lastModified;
+
+    CachedFile() = default;
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+    ~CachedFile() {
+        if(data) { munmap(data, st.st_size); }
+        if(fd >= 0) { close(fd); }
+    }
+};
+
+/*
+静态资源的打开文件缓存：以路径为键保存fd、stat结果、映射和MIME类型，命中时不再stat/open/mmap/munmap
+分成若干分片，每个分片一把锁和一条LRU链，按条目数和字节数淘汰
+条目用shared_ptr计数，被淘汰或失效后，正在发送的响应仍然持有自己的映射
+用inotify监视资源目录，文件被修改、删除或替换时使对应条目失效
+超过mmap阈值的大文件不映射，只保留fd，由连接用sendfile发送；这类条目只占fd，不计入字节预算
+没有Init时只负责打开文件，不做缓存
+*/
+class FileCache {
+public:
+    static FileCache* Instance();
+
+    // root：资源目录；maxEntries/maxBytes：缓存的条目数和字节数上限；mmapLimit：超过这个大小的文件改用sendfile
+    void Init(const std::string& root, size_t maxEntries, size_t maxBytes, size_t mmapLimit);
+    void Close();
+
+    // 返回可读的普通文件，文件不存在、是目录或没有读权限时返回nullptr
+    std::shared_ptr<const CachedFile> Get(const std::string& path);
+    // 只查缓存，不在缓存中时返回nullptr，不会打开文件
+    std::shared_ptr<const CachedFile> Lookup(const std::string& path);
+    // 返回origin（path打开的文件）的压缩版本：优先用不比原文件旧的.br/.gz预压缩文件，
+    // 其次在启用缓存时把mmap的文本文件压缩一次放入缓存；都没有时返回nullptr
+    // 结果的mime、Last-Modified和原文件相同，ETag为原文件的ETag加上编码名
+    std::shared_ptr<const CachedFile> GetEncoded(const std::string& path, const CachedFile& origin, Compressor::ENCODING enc);
+    // 只查缓存中origin的压缩版本，不找预压缩文件也不压缩
+    std::shared_ptr<const CachedFile> LookupEncoded(const std::string& path, const CachedFile& origin, Compressor::ENCODING enc);
+
+    void Invalidate(const std::string& path);
+    void Clear();
+
+private:
+    FileCache();
+    ~FileCache();
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<std::pair<std::string, std::shared_ptr<const CachedFile>>> lru;    // 表头为最近使用
+        std::unordered_map<std::string, decltype(lru)::iterator> index;
+        size_t bytes = 0;
+        uint64_t epoch = 0;     // 每次失效加一，未命中时据此判断打开期间文件是否变过
+    };
+
+    std::shared_ptr<CachedFile> Open_(const std::string& path) const;
+    std::shared_ptr<CachedFile> Encode_(const std::string& key, const CachedFile& origin, Compressor::ENCODING enc) const;
+    std::shared_ptr<const CachedFile> Insert_(const std::string& key, std::shared_ptr<const CachedFile> file, uint64_t epoch);
+    void Erase_(const std::string& key);
+    std::shared_ptr<const CachedFile> FindEncoded_(const std::string& key, const CachedFile& origin,
+                                                   Compressor::ENCODING enc, uint64_t* epoch);
+    static std::string EncodedKey_(const std::string& key, Compressor::ENCODING enc) { return key + '\0' + Compressor::Name(enc); }
+    static size_t Cost_(const CachedFile& file) { return file.data ? file.st.st_size : 0; }
+    static std::string Normalize_(const std::string& path);
+    Shard& ShardOf_(const std::string& key);
+    void Evict_(Shard& shard);
+
+    void AddWatch_(const std::string& dir);
+    void WatchThread_();
+
+    static const int SHARD_NUM = 16;
+
+    bool isOpen_;
+    size_t maxEntries_;     // 每个分片的上限
+    size_t maxBytes_;
+    size_t mmapLimit_;
+    Shard shards_[SHARD_NUM];
+
+    int inotifyFd_;
+    int stopFd_;    // eventfd，用来唤醒并结束监视线程
+    std::unordered_map<int, std::string> watchDirs_;   // wd -> 目录，只在监视线程中使用（启动前除外）
+    std::thread watchThread_;
+};
+
+#endif //FILE_CACHE_H
@@ -4,11 +4,23 @@ using namespace std;
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+int HttpConn::idleTimeoutMS = 0;
+int HttpConn::headerTimeoutMS = 0;
+int HttpConn::bodyTimeoutMS = 0;
+int HttpConn::minRate = 0;
+size_t HttpConn::inlineMaxBytes = 0;
 
-HttpConn::HttpConn() { 
+HttpConn::HttpConn() : readBuff_(0, true), writeBuff_(0, true) { 
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    outIdx_ = 0;
+    toWrite_ = 0;
+    dbState_ = DB_NONE;
+    slowPending_ = false;
+    interim_ = false;
+    phase_ = IDLE;
+    deadline_ = INT64_MAX;
 };
 
 HttpConn::~HttpConn() { 
@@ -20,14 +32,22 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     userCount++;
     addr_ = addr;
     fd_ = fd;
-    writeBuff_.RetrieveAll();
+    ReleaseOutput_();
     readBuff_.RetrieveAll();
+    request_.Init();
+    dbState_ = DB_NONE;
+    slowPending_ = false;
+    interim_ = false;
+    SetPhase_(IDLE);
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
 void HttpConn::Close() {
     response_.UnmapFile();
+    ReleaseOutput_();
+    readBuff_.RetrieveAll();    // 没处理完的数据不要了，块马上还回去，不等fd被复用
+    request_.Init();
     if(isClose_ == false){
         isClose_ = true; 
         userCount--;
@@ -57,69 +77,223 @@ int HttpConn::GetPort() const {
 // 利用whlie循环读取数据，直到发生错误或者读取完所有数据
 ssize_t HttpConn::read(int* saveErrno) {
     ssize_t len = -1;
+    size_t total = 0;
     do {
         len = readBuff_.ReadFd(fd_, saveErrno); //将fd的内容读到缓冲区
         if (len <= 0) {
             break;
         }
+        total += len;
     } while (isET); // ET:边沿触发要一次性全部读出
+    if(total > 0) {
+        if(Phase() == IDLE) {
+            SetPhase_(HEADER);  // 新请求的第一个字节，首部要在headerTimeoutMS内收完
+        } else if(Phase() == BODY) {
+            Progress_(total);
+        }
+    }
     return len;
 }
 
-//将writeBuff_缓冲区的数据复制到iov_缓冲区中，并随后使用系统调用writev将iov_中的数据一次性写入套接字中。
+void HttpConn::SetPhase_(PHASE phase) {
+    int timeout = phase == IDLE ? idleTimeoutMS : (phase == HEADER ? headerTimeoutMS : bodyTimeoutMS);
+    phase_.store(phase, std::memory_order_relaxed);
+    deadline_.store(timeout > 0 ? LoopClock::NowMs() + timeout : INT64_MAX, std::memory_order_relaxed);
+}
+
+// 慢速上传/下载：速率低于minRate时顺延得比时间流逝慢，最终超时
+void HttpConn::Progress_(size_t bytes) {
+    if(bodyTimeoutMS <= 0) {
+        return;
+    }
+    int64_t cap = LoopClock::NowMs() + bodyTimeoutMS;   // 一次突发传输不能换来无限长的空闲
+    int64_t deadline = cap;
+    if(minRate > 0) {
+        deadline = std::min(Deadline() + static_cast<int64_t>(bytes) * 1000 / minRate, cap);
+    }
+    deadline_.store(deadline, std::memory_order_relaxed);
+}
+
+//将out_中的响应数据写入套接字：连续的内存段（writeBuff_中的头部和映射的文件）用writev一次写出，未映射的大文件用sendfile发送
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
     do {
-        len = writev(fd_, iov_, iovCnt_);
-        // 将iov的内容写到fd中
-        // iovCnt_ 是iov_数组中缓冲区的数量
+        if(outIdx_ >= out_.size()) {
+            return 0;
+        }
+        const Chunk& first = out_[outIdx_];
+        if(first.data) {
+            struct iovec iov[MAX_IOV];
+            int cnt = 0;
+            for(size_t i = outIdx_; i < out_.size() && out_[i].data && cnt < MAX_IOV; i++) {
+                iov[cnt].iov_base = const_cast<char*>(out_[i].data);
+                iov[cnt].iov_len = out_[i].len;
+                cnt++;
+            }
+            len = writev(fd_, iov, cnt);
+        } else {
+            // 显式传入偏移，不改变共享fd的文件位置；EAGAIN时下次从记录的偏移继续
+            off_t offset = first.offset;
+            len = sendfile(fd_, first.fd, &offset, first.len);
+        }
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            //这个if说明写入fd_的数据大于第一个缓冲区的数据
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);//指针后移，已经写了iov_[1]缓冲区的（len - iov_[0）.iov_len)，再加上原来的起址
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll(); //第一个缓冲区的写完了，writeBuff_就可以清空了
-                iov_[0].iov_len = 0;
-            }
-        }
-        else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
+        Progress_(len);
+        toWrite_ -= len;
+        Advance_(static_cast<size_t>(len));
+        if(toWrite_ == 0) {     /* 传输结束 */
+            ReleaseOutput_();
+            break;
         }
     } while(isET || ToWriteBytes() > 10240);
     return len;
 }
 
-bool HttpConn::process() {
-    request_.Init(); //用于处理HTTP请求
-    if(readBuff_.ReadableBytes() <= 0) {
-        return false;
+// 跳过已经写完的段，最后一个没写完的从中间继续
+void HttpConn::Advance_(size_t len) {
+    while(len > 0 && outIdx_ < out_.size()) {
+        Chunk& cur = out_[outIdx_];
+        if(len >= cur.len) {
+            len -= cur.len;
+            outIdx_++;
+        } else {
+            if(cur.data) { cur.data += len; }
+            cur.offset += len;
+            cur.len -= len;
+            len = 0;
+        }
     }
-    else if(request_.parse(readBuff_)) {    // 解析成功
-        LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    } else {
-        response_.Init(srcDir, request_.path(), false, 400);
+}
+
+void HttpConn::ReleaseOutput_() {
+    writeBuff_.RetrieveAll();
+    files_.clear();
+    out_.clear();
+    outIdx_ = 0;
+    toWrite_ = 0;
+}
+
+void HttpConn::Verify() {
+    assert(dbState_ == DB_PENDING);
+    request_.Verify();
+    dbState_ = DB_DONE;
+}
+
+void HttpConn::RejectDb() {
+    assert(dbState_ == DB_PENDING);
+    dbState_ = DB_BUSY;
+}
+
+bool HttpConn::process(bool fastOnly) {
+    // 每个响应的各段（头部在writeBuff_中的偏移，或文件中的一段）和它的文件；先记偏移，最后再按writeBuff_的块生成发送段
+    struct Part {
+        HttpResponse::Segment seg;
+        const CachedFile* file;
+    };
+    std::vector<Part> parts;
+    int cnt = 0;
+    interim_ = false;
+    if(dbState_ == DB_PENDING || (fastOnly && slowPending_)) {
+        return false;   // 数据库通道或线程池还没处理完，后面的请求要等它的响应之后
     }
+    // 解析进度保存在request_中，请求不完整时停下，等下一次读到数据后继续
+    while(cnt < MAX_PIPELINE && (dbState_ != DB_NONE || slowPending_ || readBuff_.ReadableBytes() > 0)) {
+        HttpRequest::PARSE_RESULT ret = HttpRequest::COMPLETE;
+        int code = 200;
+        if(dbState_ != DB_NONE) {
+            code = (dbState_ == DB_BUSY) ? 503 : 200;  // 数据库通道处理过的请求，接着生成响应
+            dbState_ = DB_NONE;
+        } else if(slowPending_) {
+            slowPending_ = false;   // 事件循环线程留下的请求，重新生成响应
+        } else {
+            ret = request_.parse(readBuff_);
+            if(ret == HttpRequest::INCOMPLETE) {
+                if(request_.TakeContinue()) {
+                    // 客户端等到100 Continue才发消息体，排在前面的响应之后发出去
+                    static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                    parts.push_back({ { true, writeBuff_.ReadableBytes(), sizeof(CONTINUE) - 1 }, nullptr });
+                    writeBuff_.Append(CONTINUE, sizeof(CONTINUE) - 1);
+                    interim_ = true;
+                }
+                break;
+            }
+            if(ret == HttpRequest::COMPLETE && request_.NeedsDb()) {
+                dbState_ = DB_PENDING;  // 交给数据库通道，前面的响应照常发送
+                break;
+            }
+        }
+        if(ret == HttpRequest::COMPLETE) {    // 解析成功
+            LOG_DEBUG("%s", request_.path().c_str());
+            response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), code);
+            if(request_.method() == "GET") {
+                response_.SetAcceptEncoding(request_.Header(HttpRequest::ACCEPT_ENCODING));
+                response_.SetConditional(request_.Header(HttpRequest::IF_NONE_MATCH), request_.Header(HttpRequest::IF_MODIFIED_SINCE));
+                if(!request_.ranges().empty()) {
+                    response_.SetRange(request_.ranges(), request_.Header(HttpRequest::IF_RANGE));
+                }
+            }
+            if(fastOnly && !response_.InCache(inlineMaxBytes)) {
+                slowPending_ = true;    // 要读磁盘或压缩，交给线程池，前面的响应照常发送
+                break;
+            }
+        } else {
+            response_.Init(srcDir, request_.path(), false, request_.ErrorCode());
+        }
+        cnt++;
 
-    response_.MakeResponse(writeBuff_); // 生成响应报文放入writeBuff_中
-    // 响应头
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
-
-    // 文件
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+        response_.MakeResponse(writeBuff_); // 生成响应报文追加到writeBuff_中
+        std::shared_ptr<const CachedFile> file = response_.DetachFile();    // 文件引用交给连接，等发送完再释放
+        for(const HttpResponse::Segment& seg : response_.Segments()) {
+            parts.push_back({ seg, seg.inBuff ? nullptr : file.get() });
+        }
+        if(file) {
+            files_.push_back(std::move(file));
+        }
+        if(!response_.IsKeepAlive()) {  // 这个响应之后连接就要关闭，后面的请求不再处理
+            break;
+        }
+    }
+    if(cnt == 0 && !interim_) {
+        // 没有完整的请求：按收到的部分决定等待哪个阶段
+        if(dbState_ == DB_PENDING || slowPending_) {
+            SetPhase_(WRITE);   // 请求已收完，等数据库通道或线程池生成响应，按发送阶段计时
+        } else if(request_.InBody()) {
+            if(Phase() != BODY) { SetPhase_(BODY); }
+        } else if(readBuff_.ReadableBytes() > 0 || request_.InProgress()) {
+            if(Phase() != HEADER) { SetPhase_(HEADER); }
+        } else if(Phase() != IDLE) {
+            SetPhase_(IDLE);
+        }
+        return false;
+    }
+    SetPhase_(WRITE);
+
+    // 按顺序生成发送段，地址相邻的内存段合并成一段；writeBuff_中的一段可能跨块，每块一段
+    out_.clear();
+    outIdx_ = 0;
+    toWrite_ = 0;
+    auto addChunk = [this](const Chunk& chunk) {
+        if(chunk.data && !out_.empty() && out_.back().data && out_.back().data + out_.back().len == chunk.data) {
+            out_.back().len += chunk.len;
+        } else {
+            out_.push_back(chunk);
+        }
+        toWrite_ += chunk.len;
+    };
+    for(const Part& part : parts) {
+        const HttpResponse::Segment& seg = part.seg;
+        if(seg.inBuff) {
+            writeBuff_.ForEachSpan(seg.offset, seg.len, [&addChunk](const char* data, size_t len) {
+                addChunk({ data, -1, 0, len });
+            });
+        } else if(part.file->data) {
+            addChunk({ part.file->data + seg.offset, part.file->fd, static_cast<off_t>(seg.offset), seg.len });
+        } else {
+            addChunk({ nullptr, part.file->fd, static_cast<off_t>(seg.offset), seg.len });   // 未映射的大文件，用sendfile
+        }
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
+    LOG_DEBUG("responses:%d, chunks:%d, to write %d", cnt, (int)out_.size(), (int)ToWriteBytes());
     return true;
 }
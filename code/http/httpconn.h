@@ -3,9 +3,13 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
+#include <sys/sendfile.h> // sendfile
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <vector>
+#include <utility>
+#include <atomic>
 
 #include "../log/log.h"
 #include "../buffer/buffer.h"
@@ -16,6 +20,14 @@
 */
 class HttpConn {
 public:
+    // 连接所处的阶段，每个阶段有自己的截止时间，由服务器的定时器检查
+    enum PHASE {
+        IDLE = 0,   // 等待下一个请求（新连接或keep-alive）
+        HEADER,     // 收到了请求的第一个字节，等待请求行和首部收完，截止时间不因收到数据而顺延
+        BODY,       // 等待消息体收完
+        WRITE,      // 发送响应
+    };
+
     HttpConn();
     ~HttpConn();
     
@@ -27,37 +39,85 @@ public:
     int GetPort() const;    //获取连接端口号
     const char* GetIP() const;  //获取连接的IP地址
     sockaddr_in GetAddr() const;    //获取连接的地址信息
-    bool process(); //处理HTTP请求，包括解析请求和生成相应
+    // 处理读缓冲区中所有完整的HTTP请求（流水线），响应按顺序合并发送
+    // fastOnly：只处理不需要I/O的请求（见HttpResponse::InCache），遇到其他请求停下，NeedsWorker()为true，
+    // 之后由线程池调用process()从这个请求接着处理
+    bool process(bool fastOnly = false);
+    bool NeedsWorker() const { return slowPending_; }
+
+    // 遇到要查数据库的请求时process停下并返回false，NeedsDb()为true；
+    // 服务器在数据库通道上调用Verify()，或者通道满了调用RejectDb()，之后再调用process生成这个请求的响应
+    bool NeedsDb() const { return dbState_ == DB_PENDING; }
+    void Verify();
+    void RejectDb();    // 这个请求回503
 
     // 写的总长度
-    int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+    size_t ToWriteBytes() const { 
+        return toWrite_; 
     }
 
+    // 当前阶段的截止时间（LoopClock::NowMs()的时间轴），由读写所在线程更新、定时器所在线程读取
+    int64_t Deadline() const { return deadline_.load(std::memory_order_relaxed); }
+    PHASE Phase() const { return phase_.load(std::memory_order_relaxed); }
+
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return interim_ || response_.IsKeepAlive();    // 400等错误响应会关闭连接，以响应为准；发完100 Continue还要收消息体
     }
 
     static bool isET;
     static const char* srcDir;
     static std::atomic<int> userCount;  // 原子，支持锁
+    static const int MAX_PIPELINE = 16; // 一次process最多处理的流水线请求数，剩下的等这批响应发完再处理
+    static int idleTimeoutMS;   // 各阶段的超时（毫秒），0表示不限制
+    static int headerTimeoutMS;
+    static int bodyTimeoutMS;   // BODY和WRITE阶段的初始时限，传输有进展时按minRate顺延，但不超过从现在起bodyTimeoutMS
+    static int minRate;         // 收发消息体的最低速率（字节/秒），每传输minRate字节顺延1秒；0表示有进展就重新计时
+    static size_t inlineMaxBytes;   // 事件循环线程直接响应的缓存文件大小上限，0表示不在事件循环线程处理（默认）
+                                    // 打开后读取和解析也在事件循环线程，慢的或大批流水线的客户端会推迟accept和其他连接
     
 private:
+    // 待发送的一段数据：内存（响应头或映射的文件），或者data为nullptr时用sendfile发送fd中[offset, offset+len)
+    struct Chunk {
+        const char* data;
+        int fd;
+        off_t offset;
+        size_t len;
+    };
+    static const int MAX_IOV = 64;  // 一次writev最多合并的内存段
+
+    // request_中已解析完、交给数据库通道的请求的进度
+    enum DB_STATE {
+        DB_NONE,
+        DB_PENDING,     // 等数据库通道处理
+        DB_DONE,        // 已验证，等process生成响应
+        DB_BUSY,        // 数据库通道满了，回503
+    };
+
+    void ReleaseOutput_();  // 响应全部发送完（或连接关闭）后清空写缓冲区并释放文件
+    void Advance_(size_t len);  // 跳过已经发送的len字节
+    void SetPhase_(PHASE phase);    // 进入新阶段，从现在开始计时
+    void Progress_(size_t bytes);   // BODY/WRITE阶段传输了bytes字节，顺延截止时间
    
     int fd_;
     struct  sockaddr_in addr_;
 
     bool isClose_;
+
+    DB_STATE dbState_;
+    bool slowPending_;  // request_中已解析完的请求要交给线程池生成响应
+    bool interim_;      // 这批输出以100 Continue结尾，发完后接着收消息体
+
+    std::atomic<PHASE> phase_;
+    std::atomic<int64_t> deadline_;
     
-    int iovCnt_;
-    struct iovec iov_[2];// 多个缓冲区的I/O操作，允许将多个缓冲区的数据一次性写入或读取到文件描述符
-    // 包括iov_base和iov_len，一个指向缓冲区的指针，一个表示缓冲区的长度
-    // 用于将响应报文的数据从缓冲区writeBuff_以及文件数据写入到客户端连接的文件描述符fd_中
-    //iov_[0] 包含了响应报文的头部和部分正文内容。iov_[0].iov_base 是指向缓冲区 writeBuff_ 中待发送数据的指针，iov_[0].iov_len 是待发送数据的长度。
-    //iov_[1] 包含了文件数据，当需要发送文件时才会用到。iov_[1].iov_base 是指向文件数据的指针，iov_[1].iov_len 是文件数据的长度。
+    std::vector<Chunk> out_;// 依次为每个响应的头部（指向writeBuff_中的一段）和文件数据，流水线上的多个响应按请求顺序排列
+    // 连续的内存段用writev一次写出；大文件没有映射，用sendfile从fd直接发送
+    size_t outIdx_;     // 第一个还没写完的段
+    size_t toWrite_;    // 剩余待写字节数
+    std::vector<std::shared_ptr<const CachedFile>> files_;   // 本批响应引用的文件，发送完才释放
     
-    Buffer readBuff_; // 读缓冲区
-    Buffer writeBuff_; // 写缓冲区
+    Buffer readBuff_; // 读缓冲区，分段模式：readv直接读进块里
+    Buffer writeBuff_; // 写缓冲区，分段模式：响应头追加时不搬动，发送时按块writev
 
     HttpRequest request_;
     HttpResponse response_;
@@ -1,6 +1,22 @@
 #include "httprequest.h"
+#include <strings.h>   // strncasecmp
+#include <charconv>    // from_chars
+#include <stdlib.h>    // mkstemp
+#include <unistd.h>    // write, unlink, link
+#include <sys/stat.h>  // fchmod
 using namespace std;
 
+// 和HEADER的顺序一致
+const string_view HttpRequest::HEADER_NAME[HEADER_COUNT] = {
+    "Host", "Connection", "Content-Length", "Content-Type", "Accept-Encoding",
+    "Range", "If-None-Match", "If-Modified-Since", "If-Range", "Cookie",
+    "Transfer-Encoding", "Expect",
+};
+
+static bool EqualsNoCase(string_view a, string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
 // 存储默认的HTML内容
 const unordered_set<string> HttpRequest::DEFAULT_HTML {
     "/index", "/register", "/login", "/welcome", "/video", "/picture",
@@ -11,69 +27,198 @@ const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
     {"/login.html", 1}, {"/register.html", 0}
 };
 
+// 接受multipart上传的页面，其他路径的multipart请求回415
+const unordered_set<string> HttpRequest::UPLOAD_PATH {
+    "/picture.html", "/video.html",
+};
+
+size_t HttpRequest::maxBodyBytes = 64 << 20;
+size_t HttpRequest::maxUploadBytes = 64 << 20;
+size_t HttpRequest::spillBytes = 64 << 10;
+const char* HttpRequest::tmpDir = "/tmp";
+const char* HttpRequest::uploadDir = nullptr;
+HttpRequest::UploadCallback HttpRequest::uploadCallback;
+
+HttpRequest::HttpRequest()
+    : bodyFd_(-1),
+      multipart_([this](const MultipartParser::Part& part) { return BeginPart_(part); },
+                 [this](const char* data, size_t len) { return PartData_(data, len); },
+                 [this]() { return EndPart_(); }),
+      uploadFd_(-1),
+      uploadLen_(0) {
+    Init();
+}
+
+HttpRequest::~HttpRequest() {
+    if(bodyFd_ >= 0) { close(bodyFd_); }
+    AbortUpload_();
+}
+
 // 初始化操作，一些清零操作
 void HttpRequest::Init() {
     state_ = REQUEST_LINE;  // 初始状态
-    method_ = path_ = version_= body_ = "";
-    header_.clear();
+    scanned_ = 0;
+    contentLen_ = 0;
+    bodyLeft_ = 0;
+    bodyLen_ = 0;
+    if(bodyFd_ >= 0) {
+        close(bodyFd_);     // 临时文件已经删除，关闭后空间就回收了
+        bodyFd_ = -1;
+    }
+    errorCode_ = 400;
+    continue_ = false;
+    AbortUpload_();     // 上一个请求的上传没收完（出错或连接关闭）
+    multipart_.Clear();
+    field_.clear();
+    uploads_.clear();
+    needsDb_ = false;
+    method_ = version_ = string_view();
+    path_.clear();      // 保留容量，下一个请求不用再分配
+    body_.clear();
+    for(string_view& value : known_) { value = string_view(); }
+    others_.clear();
     post_.clear();
+    ranges_.clear();
+    arena_.Reset();
 }
 
-// 解析处理
-bool HttpRequest::parse(Buffer& buff) {
-    const char END[] = "\r\n";
-    if(buff.ReadableBytes() == 0)   // 没有可读的字节
-        return false;
-    // 读取数据开始
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        // 从buff中的读指针开始到读指针结束，这块区域是未读取得数据并去处"\r\n"，返回有效数据得行末指针
-        const char* lineend = search(buff.Peek(), buff.BeginWriteConst(), END, END+2);  //从写指针的位置到读指针的位置搜索"\r\n", 返回指向缓冲区第一个\r\n的指针
-        string line(buff.Peek(), lineend);  // 将找到的一行存储在字符串中
+// 解析处理：直接在buff.Peek()上按行切分，每解析完一行就从buff中取走
+// LineScanner一次扫出一批完整的行以及每行的':'和' '，逐行解析时不再查找分隔符
+// 消息体和chunked的块数据不按行扫描，收到多少取走多少，存进body_或临时文件，不在buff里攒着
+// 数据不够时返回INCOMPLETE并记住进度，下次读到新数据后从那里继续
+HttpRequest::PARSE_RESULT HttpRequest::parse(Buffer& buff) {
+    if(state_ == FINISH) {  // 上一个请求已经处理完，开始解析新的请求
+        Init();
+    }
+    LineScanner::Line lines[SCAN_BATCH];
+    size_t lineCnt = 0, next = 0;
+    const char* base = nullptr;     // 这一批行的偏移相对于扫描时的Peek()，取走前面的行不影响后面的行的地址
+    while(state_ != FINISH) {
+        if(state_ == BODY || state_ == CHUNK_DATA) {
+            size_t n = std::min(bodyLeft_, buff.ReadableBytes());
+            if(n == 0) {
+                return INCOMPLETE;
+            }
+            bool ok = true;
+            buff.ForEachSpan(0, n, [this, &ok](const char* data, size_t len) {
+                ok = ok && AppendBody_(data, len);
+            });
+            if(!ok) {
+                return BAD_REQUEST;     // AppendBody_已经设置了errorCode_
+            }
+            buff.Retrieve(n);
+            bodyLeft_ -= n;
+            if(bodyLeft_ > 0) {
+                return INCOMPLETE;
+            }
+            if(state_ == BODY) {
+                if(!FinishBody_()) {
+                    return BAD_REQUEST;
+                }
+            } else {
+                state_ = CHUNK_END;
+            }
+            lineCnt = next = 0;     // 取走消息体后前面扫出的行都失效了
+            continue;
+        }
+        if(next == lineCnt) {
+            base = buff.Peek();
+            size_t readable = buff.ContiguousBytes();
+            size_t window = std::min(readable, scanned_ + SCAN_WINDOW);
+            // 只在上次没扫描过的部分里找'\n'
+            lineCnt = LineScanner::Scan(base, window, scanned_, lines, SCAN_BATCH);
+            next = 0;
+            if(lineCnt == 0) {
+                scanned_ = window;
+                if(scanned_ > MAX_LINE) {
+                    LOG_ERROR("Line too long");
+                    return BAD_REQUEST;
+                }
+                if(window < readable) {
+                    continue;   // 这一段里没有换行，接着往后扫
+                }
+                if(readable < buff.ReadableBytes()) {
+                    // 这一行跨了缓冲区的块，拼成连续的再找，最多拼到超过行长上限
+                    buff.Pullup(std::min(buff.ReadableBytes(), MAX_LINE + 1));
+                    continue;
+                }
+                return INCOMPLETE;
+            }
+            scanned_ = 0;
+        }
+        const LineScanner::Line& cur = lines[next++];
+        size_t len = cur.end - cur.begin;
+        if(len > MAX_LINE) {    // 分几次扫描才找到行尾的长行
+            LOG_ERROR("Line too long");
+            return BAD_REQUEST;
+        }
+        const char* begin = base + cur.begin;
+        std::string_view line(begin, (len > 0 && begin[len - 1] == '\r') ? len - 1 : len);
+        // 分隔符换算成行内的偏移，不在这一行（被'\r'截掉）时为npos
+        size_t colon = cur.colon < cur.begin + line.size() ? cur.colon - cur.begin : std::string_view::npos;
+        size_t space = cur.space < cur.begin + line.size() ? cur.space - cur.begin : std::string_view::npos;
         switch (state_)
         {
         case REQUEST_LINE:
             // 解析错误
-            if(!ParseRequestLine_(line)) {
-                return false;
+            if(!ParseRequestLine_(line, space)) {
+                return BAD_REQUEST;
             }
             ParsePath_();   // 解析路径
+            needsDb_ = (method_ == "POST" && DEFAULT_HTML_TAG.count(path_));
             break;
         case HEADERS:
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) {  // 说明是get请求，后面为\r\n
-                state_ = FINISH;   // 提前结束
+            if(!(line.empty() ? BeginBody_() : ParseHeader_(line, colon))) {
+                return BAD_REQUEST;
             }
             break;
-        case BODY:
-            ParseBody_(line);
+        case CHUNK_SIZE:
+            if(!ParseChunkSize_(line)) {
+                return BAD_REQUEST;
+            }
             break;
-        default:
+        case CHUNK_END:
+            if(!line.empty()) {
+                LOG_ERROR("Chunk Error");
+                return BAD_REQUEST;
+            }
+            state_ = CHUNK_SIZE;
             break;
-        }
-        if(lineend == buff.BeginWrite()) {  // 读完了
-            buff.RetrieveAll();
+        case TRAILERS:
+            if(line.empty() && !FinishBody_()) {    // 尾部首部不使用
+                return BAD_REQUEST;
+            }
+            break;
+        default:
             break;
         }
-        buff.RetrieveUntil(lineend + 2);        // 跳过回车换行
+        buff.Retrieve(len + 1);     // 跳过回车换行
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
+    LOG_DEBUG("[%.*s], [%s], [%.*s]", (int)method_.size(), method_.data(), path_.c_str(), (int)version_.size(), version_.data());
+    return COMPLETE;
 }
 
-// 解析HTTP请求行
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$"); //正则表达式 ^表示行的开始，([^ ]*)匹配任何不含空格的字符序列，空格 匹配一个空格字符，HTTP/ 匹配一个HTTP/，$表示行的结束
-    smatch Match;   // 定义一个std::match对象，用来存储正则表达式匹配的结果，如果字符串成功匹配正则表达式，那么Match对象会被填充为匹配的子序列
-    // 在匹配规则中，以括号()的方式来划分组别 一共三个括号 [0]表示整体
-    if(regex_match(line, Match, patten)) {  // 匹配指定字符串整体是否符合
-        method_ = Match[1];
-        path_ = Match[2];
-        version_ = Match[3];
-        state_ = HEADERS;
-        return true;
+// 解析HTTP请求行：METHOD SP TARGET SP HTTP/VERSION
+bool HttpRequest::ParseRequestLine_(std::string_view line, size_t sp1) {
+    if(sp1 == std::string_view::npos || sp1 == 0) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if(sp2 == std::string_view::npos || sp2 == sp1 + 1) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    std::string_view version = line.substr(sp2 + 1);
+    if(version.size() <= 5 || version.substr(0, 5) != "HTTP/" || version.find(' ') != std::string_view::npos) {
+        LOG_ERROR("RequestLine Error");
+        return false;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    method_ = arena_.Copy(line.substr(0, sp1));
+    path_.assign(line.data() + sp1 + 1, sp2 - sp1 - 1);
+    version_ = arena_.Copy(version.substr(5));
+    state_ = HEADERS;
+    return true;
 }
 
 // 解析路径，统一一下path名称,方便后面解析资源
@@ -87,22 +232,343 @@ void HttpRequest::ParsePath_() {
     }
 }
 
-void HttpRequest::ParseHeader_(const string& line) {
-    // ^字符串的开始 ([^:]*)匹配任何不包含冒号的字符序列 :匹配冒号 空格?匹配零个或一个空格 (.*)匹配任何字符除了换行符 $字符串的结束
-    regex patten("^([^:]*): ?(.*)$");
-    smatch Match;
-    if(regex_match(line, Match, patten)) {
-        header_[Match[1]] = Match[2];
-    } else {    // 匹配失败说明首部行匹配完了，状态变化
+// 解析首部行 name: value
+bool HttpRequest::ParseHeader_(std::string_view line, size_t colon) {
+    if(colon == std::string_view::npos || colon == 0) {
+        LOG_ERROR("Header Error");
+        return false;
+    }
+    std::string_view key = line.substr(0, colon);
+    std::string_view value = line.substr(colon + 1);
+    // 去掉值两边的空白
+    while(!value.empty() && (value.front() == ' ' || value.front() == '\t')) { value.remove_prefix(1); }
+    while(!value.empty() && (value.back() == ' ' || value.back() == '\t')) { value.remove_suffix(1); }
+    value = arena_.Copy(value);
+    HEADER h = Known_(key);
+    if(h == HEADER_COUNT) {
+        others_.emplace_back(arena_.Copy(key), value);
+        return true;
+    }
+    if(h == CONTENT_LENGTH) {
+        // 必须全是数字；重复出现时值要相同，否则无法确定消息体在哪里结束
+        size_t len = 0;
+        auto res = from_chars(value.data(), value.data() + value.size(), len);
+        if(value.empty() || res.ec != errc() || res.ptr != value.data() + value.size() ||
+           (!known_[h].empty() && len != contentLen_)) {
+            LOG_ERROR("Content-Length Error");
+            return false;
+        }
+        contentLen_ = len;
+    }
+    else if(h == RANGE) {
+        ParseRange_(value);
+    }
+    known_[h] = value;  // 重复的首部以最后一个为准
+    return true;
+}
+
+// 首部后的空行：同时有chunked和Content-Length的请求拒绝，防止和前面的代理对消息体的边界理解不一致
+// multipart只在上传页面接受，且要配置了上传目录或回调；这些检查都在收消息体之前，不会先回100再拒绝
+bool HttpRequest::BeginBody_() {
+    string_view te = known_[TRANSFER_ENCODING];
+    if(!te.empty() && (!EqualsNoCase(te, "chunked") || !known_[CONTENT_LENGTH].empty())) {
+        LOG_ERROR("Transfer-Encoding Error");
+        return false;
+    }
+    if(te.empty() && contentLen_ == 0) {
+        needsDb_ = false;   // 没有表单，直接返回登录/注册页面
+        state_ = FINISH;
+        return true;
+    }
+    string_view contentType = known_[CONTENT_TYPE];
+    string_view boundary = MultipartParser::Boundary(contentType);
+    if(!boundary.empty()) {
+        if(!UPLOAD_PATH.count(path_)) {
+            LOG_WARN("Multipart rejected: %s", path_.c_str());
+            errorCode_ = 415;
+            return false;
+        }
+        if(!uploadDir && !uploadCallback) {
+            LOG_WARN("Upload rejected: uploads disabled");
+            errorCode_ = 403;
+            return false;
+        }
+        multipart_.Reset(boundary);
+        needsDb_ = false;
+    } else if(contentType.size() >= 10 && strncasecmp(contentType.data(), "multipart/", 10) == 0) {
+        LOG_ERROR("Multipart boundary Error");
+        return false;
+    }
+    if(contentLen_ > BodyLimit_()) {
+        LOG_WARN("Body too large: %zu", contentLen_);
+        errorCode_ = 413;
+        return false;
+    }
+    if(te.empty()) {
+        bodyLeft_ = contentLen_;
         state_ = BODY;
+    } else {
+        state_ = CHUNK_SIZE;
     }
+    continue_ = EqualsNoCase(known_[EXPECT], "100-continue") && version_ == "1.1";
+    return true;
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
+// 上传页面的multipart消息体按maxUploadBytes限制，其他消息体按maxBodyBytes
+size_t HttpRequest::BodyLimit_() const {
+    return multipart_.Active() ? maxUploadBytes : maxBodyBytes;
+}
+
+// 块大小行：十六进制的长度，后面可以跟;扩展（忽略），长度为0表示最后一块
+bool HttpRequest::ParseChunkSize_(std::string_view line) {
+    string_view hex = line.substr(0, line.find(';'));
+    while(!hex.empty() && (hex.back() == ' ' || hex.back() == '\t')) { hex.remove_suffix(1); }
+    size_t size = 0;
+    auto res = from_chars(hex.data(), hex.data() + hex.size(), size, 16);
+    if(hex.empty() || res.ec != errc() || res.ptr != hex.data() + hex.size()) {
+        LOG_ERROR("Chunk Error");
+        return false;
+    }
+    if(size == 0) {
+        state_ = TRAILERS;
+        return true;
+    }
+    if(size > BodyLimit_() - bodyLen_) {
+        LOG_WARN("Body too large: %zu", bodyLen_ + size);
+        errorCode_ = 413;
+        return false;
+    }
+    bodyLeft_ = size;
+    state_ = CHUNK_DATA;
+    return true;
+}
+
+HttpRequest::HEADER HttpRequest::Known_(string_view key) {
+    for(int i = 0; i < HEADER_COUNT; i++) {
+        if(EqualsNoCase(key, HEADER_NAME[i])) {
+            return static_cast<HEADER>(i);
+        }
+    }
+    return HEADER_COUNT;
+}
+
+// 解析 Range: bytes=0-499,500-,-200 ，单位不区分大小写，列表的空元素跳过；格式不对时整个忽略（按没有Range处理）
+void HttpRequest::ParseRange_(std::string_view value) {
+    ranges_.clear();
+    if(!EqualsNoCase(value.substr(0, 6), "bytes=")) { return; }     // 范围单位不区分大小写
+    value.remove_prefix(6);
+    while(!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view spec = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+        while(!spec.empty() && (spec.front() == ' ' || spec.front() == '\t')) { spec.remove_prefix(1); }
+        while(!spec.empty() && (spec.back() == ' ' || spec.back() == '\t')) { spec.remove_suffix(1); }
+        if(spec.empty()) { continue; }  // 列表里的空元素（如"0-1,,5-6"）跳过
+        size_t dash = spec.find('-');
+        if(dash == std::string_view::npos) { ranges_.clear(); return; }
+        long long num[2] = { -1, -1 };
+        std::string_view part[2] = { spec.substr(0, dash), spec.substr(dash + 1) };
+        for(int i = 0; i < 2; i++) {
+            if(part[i].empty()) { continue; }
+            if(part[i].size() > 18) { ranges_.clear(); return; }    // 防止溢出
+            num[i] = 0;
+            for(char ch : part[i]) {
+                if(ch < '0' || ch > '9') { ranges_.clear(); return; }
+                num[i] = num[i] * 10 + (ch - '0');
+            }
+        }
+        if((num[0] < 0 && num[1] < 0) || (num[0] >= 0 && num[1] >= 0 && num[1] < num[0])) {
+            ranges_.clear();
+            return;
+        }
+        ranges_.emplace_back(num[0], num[1]);
+    }
+}
+
+static bool WriteAll(int fd, const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("Write body file error: %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 消息体先放在body_里，总长超过spillBytes时建一个临时文件，把已有的和后面的都写进去
+// multipart的消息体直接交给multipart_，按部分分别存放
+bool HttpRequest::AppendBody_(const char* data, size_t len) {
+    if(multipart_.Active()) {
+        bodyLen_ += len;
+        if(!multipart_.Feed(data, len)) {
+            if(errorCode_ == 400) { LOG_ERROR("Multipart Error"); }
+            return false;
+        }
+        return true;
+    }
+    if(bodyFd_ < 0 && body_.size() + len > spillBytes) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/webserver-body-XXXXXX", tmpDir);
+        bodyFd_ = mkstemp(path);
+        if(bodyFd_ < 0) {
+            LOG_ERROR("Create body file error: %s", strerror(errno));
+            errorCode_ = 500;
+            return false;
+        }
+        unlink(path);   // 只通过fd访问，关闭后自动删除
+        LOG_DEBUG("Body spills to temp file, fd:%d", bodyFd_);
+        std::string head;
+        head.swap(body_);   // 内存里的部分写进文件后释放
+        if(!WriteAll(bodyFd_, head.data(), head.size())) {
+            errorCode_ = 500;
+            return false;
+        }
+    }
+    bodyLen_ += len;
+    if(bodyFd_ < 0) {
+        body_.append(data, len);
+        return true;
+    }
+    if(!WriteAll(bodyFd_, data, len)) {
+        errorCode_ = 500;
+        return false;
+    }
+    return true;
+}
+
+bool HttpRequest::FinishBody_() {
+    continue_ = false;
+    state_ = FINISH;
+    if(multipart_.Active()) {
+        if(!multipart_.Done()) {
+            LOG_ERROR("Multipart body ends without closing boundary");
+            return false;
+        }
+        return true;
+    }
+    if(bodyFd_ >= 0) {
+        needsDb_ = false;   // 登录/注册表单不会这么大
+        return true;
+    }
     ParsePost_();
-    state_ = FINISH;    // 状态转换为下一个状态
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%s, len:%d", body_.c_str(), body_.size());
+    return true;
+}
+
+// 只留文件名本身，去掉客户端路径和控制字符，不以'.'开头，防止写到uploadDir外面或成为隐藏文件
+static string SafeName(string_view filename) {
+    size_t slash = filename.find_last_of("/\\");
+    if(slash != string_view::npos) { filename.remove_prefix(slash + 1); }
+    string name(filename.substr(0, 200));
+    for(char& ch : name) {
+        if(static_cast<unsigned char>(ch) < 0x20 || ch == 0x7f) { ch = '_'; }
+    }
+    if(name.empty() || name[0] == '.') { name.insert(0, "upload"); }
+    return name;
+}
+
+bool HttpRequest::BeginPart_(const MultipartParser::Part& part) {
+    field_.clear();
+    uploadLen_ = 0;
+    if(part.filename.empty() || uploadCallback) {
+        return true;    // 普通字段收到field_里；有回调时数据直接交给回调
+    }
+    if(!uploadDir) {
+        LOG_WARN("Upload rejected: no upload dir");
+        errorCode_ = 403;
+        return false;
+    }
+    uploadTmp_ = string(uploadDir) + "/.upload-XXXXXX";
+    uploadFd_ = mkstemp(&uploadTmp_[0]);
+    if(uploadFd_ < 0) {
+        LOG_ERROR("Create upload file error: %s", strerror(errno));
+        uploadTmp_.clear();
+        errorCode_ = 500;
+        return false;
+    }
+    fchmod(uploadFd_, 0644);    // mkstemp建的文件只有自己能读
+    return true;
+}
+
+bool HttpRequest::PartData_(const char* data, size_t len) {
+    const MultipartParser::Part& part = multipart_.part();
+    uploadLen_ += len;
+    if(part.filename.empty()) {
+        if(field_.size() + len > MAX_FIELD) {
+            LOG_WARN("Form field too large: %s", part.name.c_str());
+            errorCode_ = 413;
+            return false;
+        }
+        field_.append(data, len);
+        return true;
+    }
+    if(uploadCallback) {
+        if(!uploadCallback(part, data, len, false)) {
+            errorCode_ = 500;
+            return false;
+        }
+        return true;
+    }
+    if(!WriteAll(uploadFd_, data, len)) {
+        errorCode_ = 500;
+        return false;
+    }
+    return true;
+}
+
+bool HttpRequest::EndPart_() {
+    const MultipartParser::Part& part = multipart_.part();
+    if(part.filename.empty()) {
+        post_[part.name] = field_;
+        return true;
+    }
+    if(uploadCallback) {
+        if(!uploadCallback(part, nullptr, 0, true)) {
+            errorCode_ = 500;
+            return false;
+        }
+        uploads_.push_back({ part.name, part.filename, "", uploadLen_ });
+        return true;
+    }
+    close(uploadFd_);
+    uploadFd_ = -1;
+    // 用link而不是rename：同名文件已经存在时不覆盖，换一个名字
+    string name = SafeName(part.filename);
+    string path = string(uploadDir) + "/" + name;
+    for(int i = 1; link(uploadTmp_.c_str(), path.c_str()) < 0; i++) {
+        if(errno != EEXIST || i > 1000) {
+            LOG_ERROR("Save upload %s error: %s", name.c_str(), strerror(errno));
+            errorCode_ = 500;
+            return false;
+        }
+        path = string(uploadDir) + "/" + to_string(i) + "-" + name;
+    }
+    unlink(uploadTmp_.c_str());
+    uploadTmp_.clear();
+    LOG_INFO("Upload %s saved to %s, %zu bytes", part.filename.c_str(), path.c_str(), uploadLen_);
+    uploads_.push_back({ part.name, part.filename, path, uploadLen_ });
+    return true;
+}
+
+void HttpRequest::AbortUpload_() {
+    if(uploadFd_ >= 0) {
+        close(uploadFd_);
+        uploadFd_ = -1;
+    }
+    if(!uploadTmp_.empty()) {
+        unlink(uploadTmp_.c_str());
+        uploadTmp_.clear();
+    }
+}
+
+bool HttpRequest::TakeContinue() {
+    bool ret = continue_;
+    continue_ = false;
+    return ret;
 }
 
 
@@ -115,24 +581,28 @@ int HttpRequest::ConverHex(char ch) {
     return ch;
 }
 
-// 处理post请求
+// 处理post请求，登录/注册的验证不在这里做，见Verify
 void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+    if(method_ == "POST" && known_[CONTENT_TYPE] == "application/x-www-form-urlencoded") {
         ParseFromUrlencoded_();     // POST请求体示例
-        if(DEFAULT_HTML_TAG.count(path_)) { // 如果是登录/注册的path
-            int tag = DEFAULT_HTML_TAG.find(path_)->second; 
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);  // 为1则是登录
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
-            }
-        }
-    }   
+    } else {
+        needsDb_ = false;
+    }
+}
+
+// 登录/注册：验证用户，成功返回欢迎页，失败返回错误页
+void HttpRequest::Verify() {
+    if(!needsDb_) { return; }
+    needsDb_ = false;
+    int tag = DEFAULT_HTML_TAG.find(path_)->second;
+    LOG_DEBUG("Tag:%d", tag);
+    bool isLogin = (tag == 1);  // 为1则是登录
+    if(UserVerify(post_["username"], post_["password"], isLogin)) {
+        path_ = "/welcome.html";
+    }
+    else {
+        path_ = "/error.html";
+    }
 }
 
 // 从url中解析编码
@@ -238,21 +708,13 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     return flag;
 }
 
-std::string HttpRequest::path() const{
+const std::string& HttpRequest::path() const{
     return path_;
 }
 
 std::string& HttpRequest::path(){
     return path_;
 }
-std::string HttpRequest::method() const {
-    return method_;
-}
-
-std::string HttpRequest::version() const {
-    return version_;
-}
-
 std::string HttpRequest::GetPost(const std::string& key) const {
     assert(key != "");
     if(post_.count(key) == 1) {
@@ -269,9 +731,20 @@ std::string HttpRequest::GetPost(const char* key) const {
     return "";
 }
 
-bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+std::string_view HttpRequest::GetHeader(std::string_view key) const {
+    HEADER h = Known_(key);
+    if(h != HEADER_COUNT) {
+        return known_[h];
     }
-    return false;
+    // 从后往前找，重复的首部以最后一个为准
+    for(auto it = others_.rbegin(); it != others_.rend(); ++it) {
+        if(EqualsNoCase(it->first, key)) {
+            return it->second;
+        }
+    }
+    return string_view();
+}
+
+bool HttpRequest::IsKeepAlive() const {
+    return EqualsNoCase(known_[CONNECTION], "keep-alive") && version_ == "1.1";
 }
\ No newline at end of file
@@ -4,11 +4,18 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
-#include <regex>    // 正则表达式
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <string.h>     // memchr
 #include <errno.h>     
 #include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
+#include "linescanner.h"
+#include "requestarena.h"
+#include "multipartparser.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 
@@ -17,44 +24,151 @@ public:
     enum PARSE_STATE {
         REQUEST_LINE,
         HEADERS,
-        BODY,
-        FINISH,        
+        BODY,           // 按Content-Length收消息体
+        CHUNK_SIZE,     // chunked编码：块大小行
+        CHUNK_DATA,     // 块数据
+        CHUNK_END,      // 块数据后面的空行
+        TRAILERS,       // 最后一块之后的尾部首部，到空行结束
+        FINISH,
+    };
+
+    // 解析结果：数据不够（保留进度，等下一次读）、请求完整、请求格式错误
+    enum PARSE_RESULT {
+        INCOMPLETE,
+        COMPLETE,
+        BAD_REQUEST,
     };
     
-    HttpRequest() { Init(); }
-    ~HttpRequest() = default;
+    // 常用首部，按下标放在固定的位置上，其余的首部按顺序放在一个数组里
+    enum HEADER {
+        HOST,
+        CONNECTION,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        ACCEPT_ENCODING,
+        RANGE,
+        IF_NONE_MATCH,
+        IF_MODIFIED_SINCE,
+        IF_RANGE,
+        COOKIE,
+        TRANSFER_ENCODING,
+        EXPECT,
+        HEADER_COUNT,
+    };
+
+    // multipart/form-data上传的一个文件
+    struct Upload {
+        std::string name;       // 表单字段名
+        std::string filename;   // 客户端给的文件名
+        std::string path;       // 保存的位置，交给uploadCallback处理时为空
+        size_t size;
+    };
+
+    // 上传文件的数据按到达的顺序一段段交给它，最后一次last为true、data为空；返回false时请求失败（500）
+    typedef std::function<bool(const MultipartParser::Part& part, const char* data, size_t len, bool last)> UploadCallback;
+
+    // Range首部中的一段[first, last]，-1表示省略：(-1, 500)为最后500字节，(500, -1)为从500到结尾
+    typedef std::pair<long long, long long> ByteRange;
+
+    HttpRequest();
+    ~HttpRequest();
+
+    HttpRequest(const HttpRequest&) = delete;
+    HttpRequest& operator=(const HttpRequest&) = delete;
 
     void Init();    // 初始化方法
-    bool parse(Buffer& buff);   //解析HTTP请求
+    PARSE_RESULT parse(Buffer& buff);   //解析HTTP请求，可以在多次读之间接着上次的位置继续
 
-    std::string path() const;   //获取HTTP请求的路径
+    const std::string& path() const;   //获取HTTP请求的路径
     std::string& path();        //设置HTTP请求的路径
-    std::string method() const; //获取HTTP请求的方法（GET、POST）
-    std::string version() const;    //获取HTTP请求的版本
+    // 方法、版本和首部的值都指向请求自己的内存，下一次parse/Init之前有效
+    std::string_view method() const { return method_; }     //获取HTTP请求的方法（GET、POST）
+    std::string_view version() const { return version_; }   //获取HTTP请求的版本
     std::string GetPost(const std::string& key) const;  //获取POST请求中的参数
     std::string GetPost(const char* key) const; //获取POST请求中的参数
+    std::string_view Header(HEADER h) const { return known_[h]; }  //常用首部的值，没有时为空
+    std::string_view GetHeader(std::string_view key) const;    //获取首部的值，名字不区分大小写，没有时返回空串
+    const std::vector<ByteRange>& ranges() const { return ranges_; }  //Range首部请求的字节范围，没有或格式错误时为空
 
     bool IsKeepAlive() const;   //检查HTTP请求是否要求保持连接
+    bool InProgress() const { return state_ != REQUEST_LINE && state_ != FINISH; }  // 请求行已解析，请求还没收完
+    bool InBody() const { return state_ >= BODY && state_ < FINISH; }   // 首部已收完，正在等消息体
+    int ErrorCode() const { return errorCode_; }    // parse返回BAD_REQUEST时响应的状态码：400、403、413、415或500
+    bool TakeContinue();    // 客户端发了Expect: 100-continue，在等消息体之前要先回100，只返回一次true
+
+    // 消息体：不超过spillBytes时在body()里，超过时写进一个已删除的临时文件，BodyFd()读取，读写位置在末尾
+    // multipart/form-data的消息体不保存：普通字段进GetPost，文件存到uploadDir或交给uploadCallback，见uploads()
+    const std::string& body() const { return body_; }
+    int BodyFd() const { return bodyFd_; }
+    size_t BodyLen() const { return bodyLen_; }
+    const std::vector<Upload>& uploads() const { return uploads_; }
+    bool NeedsDb() const { return needsDb_; }   // 登录/注册表单，要查数据库才能决定返回的页面
+    void Verify();  // 查数据库验证用户并改写path，会阻塞，由服务器放到数据库通道执行
+
+    static const size_t MAX_LINE = 8192;    // 请求行/首部行的最大长度
+    static const size_t SCAN_BATCH = 32;    // 一次扫描最多索引的行数
+    static const size_t SCAN_WINDOW = 4096; // 一次扫描的范围，首部后面的消息体不会被整段扫描
+
+    static size_t maxBodyBytes;     // 消息体的上限，超过时回413
+    static size_t maxUploadBytes;   // 上传页面的multipart消息体的上限
+    static size_t spillBytes;       // 消息体超过这个大小时写临时文件，不留在内存里
+    static const char* tmpDir;      // 临时文件的目录
+    static const char* uploadDir;   // 上传的文件保存在这里，和uploadCallback都没有时不接受上传（403）
+    static UploadCallback uploadCallback;   // 设置了就把上传的文件交给它，不写磁盘
+    static const size_t MAX_FIELD = 65536;  // multipart里普通字段的最大长度
 
 private:
-    bool ParseRequestLine_(const std::string& line);    // 处理请求行
-    void ParseHeader_(const std::string& line);         // 处理请求头
-    void ParseBody_(const std::string& line);           // 处理请求体
+    bool ParseRequestLine_(std::string_view line, size_t sp1);  // 处理请求行，sp1为第一个空格的位置
+    bool ParseHeader_(std::string_view line, size_t colon);     // 处理请求头，colon为第一个':'的位置
+    bool ParseChunkSize_(std::string_view line);        // 处理chunked编码的块大小行
+    bool BeginBody_();                                  // 首部结束，按Content-Length或chunked决定怎么收消息体
+    size_t BodyLimit_() const;                          // 这个请求的消息体上限
+    bool AppendBody_(const char* data, size_t len);     // 收到一段消息体，超过spillBytes时转到临时文件
+    bool FinishBody_();                                 // 消息体收完
 
+    bool BeginPart_(const MultipartParser::Part& part); // multipart的一个部分开始，决定数据存到哪里
+    bool PartData_(const char* data, size_t len);
+    bool EndPart_();
+    void AbortUpload_();                                // 删掉没有收完的上传文件
+
+    void ParseRange_(std::string_view value);           // 处理Range首部
     void ParsePath_();                                  // 处理请求路径
     void ParsePost_();                                  // 处理Post事件
     void ParseFromUrlencoded_();                        // 从url种解析编码
 
+    static HEADER Known_(std::string_view key);         // 常用首部的下标，不是常用首部时为HEADER_COUNT
     static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);  // 用户验证
 
     //类的私有成员变量，存储HTTP请求的状态、方法、路径、版本、主体、头部、POST参数
     PARSE_STATE state_;
-    std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header_;
+    size_t scanned_;        // 当前行已经查找过换行符的字节数，续读时不再重复扫描
+    size_t contentLen_;     // 请求体长度，来自Content-Length
+    size_t bodyLeft_;       // BODY/CHUNK_DATA状态下还要收的字节数
+    size_t bodyLen_;        // 已经收到的消息体长度
+    int bodyFd_;            // 消息体的临时文件，没有时为-1
+    int errorCode_;
+    bool continue_;         // 要先回100 Continue
+    bool needsDb_;          // 解析完请求行时按方法和路径分类，没有表单时再取消
+    std::string_view method_, version_;    // 在arena_里
+    std::string path_, body_;               // path_会被改写，body_解码时原地修改，用string
+    std::string_view known_[HEADER_COUNT];  // 常用首部的值，在arena_里
+    std::vector<std::pair<std::string_view, std::string_view>> others_;    // 其余首部的名字和值，在arena_里
     std::unordered_map<std::string, std::string> post_;
+    std::vector<ByteRange> ranges_;
+    RequestArena arena_;    // 请求的字符串都拷到这里，Init时整块回收
+
+    MultipartParser multipart_;
+    std::string field_;         // 正在收的普通字段的值
+    int uploadFd_;              // 正在收的上传文件，先写在uploadDir下的临时文件里，收完再链接到正式的名字
+    std::string uploadTmp_;
+    size_t uploadLen_;
+    std::vector<Upload> uploads_;
+
+    static const std::string_view HEADER_NAME[HEADER_COUNT];
 
     static const std::unordered_set<std::string> DEFAULT_HTML; //静态常量无序集合，存储默认的HTML内容
     static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG; //静态常量无序映射，存储默认的HTML标签以及对应的整数值
+    static const std::unordered_set<std::string> UPLOAD_PATH;   // 接受multipart上传的路径
     static int ConverHex(char ch);  // 16进制转换为10进制
 };
 
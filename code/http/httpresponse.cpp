@@ -28,9 +28,16 @@ const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
 //状态码
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 413, "Payload Too Large" },
+    { 415, "Unsupported Media Type" },
+    { 416, "Range Not Satisfiable" },
+    { 500, "Internal Server Error" },
+    { 503, "Service Unavailable" },
 };
 
 //状态路径
@@ -44,8 +51,12 @@ HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
+    textStart_ = 0;
+    acceptEncodings_ = 0;
+    preferredCnt_ = 0;
+    encoding_ = Compressor::IDENTITY;
+    vary_ = false;
 };
 
 HttpResponse::~HttpResponse() {
@@ -55,38 +66,263 @@ HttpResponse::~HttpResponse() {
 //初始化
 void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
     assert(srcDir != "");
-    if(mmFile_) { UnmapFile(); }
+    UnmapFile();
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
+    ranges_.clear();
+    ifRange_.clear();
+    ifNoneMatch_.clear();
+    ifModifiedSince_.clear();
+    acceptEncodings_ = 0;
+    preferredCnt_ = 0;
+    encoding_ = Compressor::IDENTITY;
+    vary_ = false;
+    notModifiedTag_.clear();
+    segments_.clear();
+    textStart_ = 0;
+}
+
+void HttpResponse::SetRange(const vector<HttpRequest::ByteRange>& ranges, string_view ifRange) {
+    if(ranges.size() > MAX_RANGES) { return; }
+    ranges_ = ranges;
+    ifRange_.assign(ifRange.data(), ifRange.size());
 }
 
 // 用于生成HTTP响应
+// 如 Accept-Encoding: gzip, deflate, br;q=0.8 ，按q值从高到低选，q相同时br优先，q=0表示不接受
+// *的q值用于没有单独列出的编码；名字不区分大小写
+void HttpResponse::SetAcceptEncoding(string_view acceptEncoding) {
+    int q[Compressor::BROTLI + 1] = { -1, -1, -1 };     // 千分之一为单位，-1为没有列出
+    int any = -1;
+    string_view list = acceptEncoding;
+    while(!list.empty()) {
+        size_t comma = list.find(',');
+        string_view item = list.substr(0, comma);
+        list = comma == string_view::npos ? string_view() : list.substr(comma + 1);
+        size_t semi = item.find(';');
+        string_view coding = item.substr(0, semi);
+        while(!coding.empty() && (coding.front() == ' ' || coding.front() == '\t')) { coding.remove_prefix(1); }
+        while(!coding.empty() && (coding.back() == ' ' || coding.back() == '\t')) { coding.remove_suffix(1); }
+        int weight = 1000;
+        if(semi != string_view::npos) {
+            size_t pos = item.find_first_of("qQ", semi);
+            if(pos != string_view::npos && pos + 1 < item.size() && item[pos + 1] == '=') {
+                double v = strtod(string(item.substr(pos + 2)).c_str(), nullptr);
+                weight = v <= 0 ? 0 : v >= 1 ? 1000 : static_cast<int>(v * 1000 + 0.5);
+            }
+        }
+        if(EqualsNoCase_(coding, "gzip") || EqualsNoCase_(coding, "x-gzip")) {
+            q[Compressor::GZIP] = weight;
+        } else if(EqualsNoCase_(coding, "br")) {
+            q[Compressor::BROTLI] = weight;
+        } else if(coding == "*") {
+            any = weight;
+        }
+    }
+    acceptEncodings_ = 0;
+    preferredCnt_ = 0;
+    for(Compressor::ENCODING enc : { Compressor::BROTLI, Compressor::GZIP }) {
+        if(q[enc] < 0) { q[enc] = any; }
+        if(q[enc] > 0) {
+            acceptEncodings_ |= 1u << enc;
+            preferred_[preferredCnt_++] = enc;
+        }
+    }
+    if(preferredCnt_ == 2 && q[preferred_[1]] > q[preferred_[0]]) {
+        swap(preferred_[0], preferred_[1]);     // 先放入的是br，只有gzip的q严格更高时才换到前面
+    }
+}
+
+bool HttpResponse::EqualsNoCase_(string_view a, string_view b) {
+    if(a.size() != b.size()) { return false; }
+    for(size_t i = 0; i < a.size(); i++) {
+        if(tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) { return false; }
+    }
+    return true;
+}
+
+void HttpResponse::SetConditional(string_view ifNoneMatch, string_view ifModifiedSince) {
+    ifNoneMatch_.assign(ifNoneMatch.data(), ifNoneMatch.size());
+    ifModifiedSince_.assign(ifModifiedSince.data(), ifModifiedSince.size());
+}
+
 void HttpResponse::MakeResponse(Buffer& buff) {
+    segments_.clear();
+    textStart_ = buff.ReadableBytes();
     /* 判断请求的资源文件 */
-    // srcDir_+path_ 表示文件的完整路径，data()获取路径的C字符串表示，S_ISDIR是一个宏函数，检查文件的类型是否是目录
-    // 使用stat函数获取文件的元文件信息，填充到mmFileStat_中
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    // srcDir_+path_ 表示文件的完整路径，S_ISDIR是一个宏函数，检查文件的类型是否是目录
+    // 文件的元信息填充到mmFileStat_中，缓存命中时不需要任何系统调用
+    if(code_ == 400 || code_ == 403 || code_ == 413 || code_ == 415 || code_ == 500 || code_ == 503) {
+        // 请求格式错误、不允许上传、消息体太大、不接受的消息体类型、保存消息体失败或者服务器忙，不再查找请求的资源
+    }
+    else if(NotModified_()) {
+        code_ = 304;    // 客户端的缓存仍然有效，只回一个没有消息体的响应
+    }
+    else if(!OpenFile_() || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;    //文件不存在或者是一个目录
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
         code_ = 403;    //没有读权限
     }
+    else if(!file_) {
+        code_ = 500;    //文件存在也可读，但打开或映射失败（fd用完、内存不足）
+    }
     else if(code_ == -1) { 
         code_ = 200; 
     }
+    if(file_ && (code_ == 200 || code_ == 206)) {
+        vary_ = Compressor::Compressible(file_->mime);
+    }
+    if(code_ == 200 && file_ && !ranges_.empty()) {
+        // If-Range的日期和文件的修改时间不一致时文件已经变了，忽略Range返回整个文件
+        if(!ifRange_.empty() && ifRange_ != file_->etag && ifRange_ != file_->lastModified) {
+            ranges_.clear();
+        }
+        else if(ResolveRanges_()) {
+            code_ = 206;
+        }
+        else {
+            code_ = 416;
+            file_.reset();  // 416只返回错误信息，不发送文件
+        }
+    }
+    if(code_ == 200) {
+        Encode_();  // 范围请求按原文件计算，不压缩
+    }
     ErrorHtml_();
     AddStateLine_(buff);
     AddHeader_(buff);
     AddContent_(buff);
+    EndText_(buff);
+}
+
+// 和MakeResponse用同样的缓存条目：原文件按路径查，压缩版本查客户端最想要的编码
+bool HttpResponse::InCache(size_t maxBytes) const {
+    shared_ptr<const CachedFile> file = FileCache::Instance()->Lookup(srcDir_ + path_);
+    if(!file || !file->data || static_cast<size_t>(file->st.st_size) > maxBytes) {
+        return false;
+    }
+    if(preferredCnt_ > 0 && Compressor::Compressible(file->mime)) {
+        return FileCache::Instance()->LookupEncoded(srcDir_ + path_, *file, preferred_[0]) != nullptr;
+    }
+    return true;
+}
+
+void HttpResponse::Encode_() {
+    if(!vary_ || !file_) {
+        return;
+    }
+    for(int i = 0; i < preferredCnt_; i++) {    // 最想要的编码没有结果（压缩失败、预压缩文件太大）时用下一个
+        Compressor::ENCODING enc = preferred_[i];
+        shared_ptr<const CachedFile> encoded = FileCache::Instance()->GetEncoded(srcDir_ + path_, *file_, enc);
+        if(encoded) {
+            file_ = move(encoded);
+            mmFileStat_.st_size = file_->st.st_size;
+            encoding_ = enc;
+            return;
+        }
+    }
+}
+
+// If-None-Match优先于If-Modified-Since；缓存中有这个文件时直接用它的stat，否则只stat，不打开文件
+bool HttpResponse::NotModified_() {
+    if(ifNoneMatch_.empty() && ifModifiedSince_.empty()) {
+        return false;
+    }
+    struct stat st;
+    string etag;
+    string mime;
+    shared_ptr<const CachedFile> cached = FileCache::Instance()->Lookup(srcDir_ + path_);
+    if(cached) {
+        st = cached->st;
+        etag = cached->etag;
+        mime = cached->mime;
+    }
+    else {
+        if(stat((srcDir_ + path_).data(), &st) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH)) {
+            return false;   // 交给后面按404/403处理
+        }
+        etag = ETag(st);
+        mime = FileType(path_);
+    }
+    bool vary = Compressor::Compressible(mime);
+    bool match = false;
+    if(!ifNoneMatch_.empty()) {
+        // 逗号分隔的列表或"*"，按弱比较，忽略W/前缀
+        string_view list(ifNoneMatch_);
+        while(!list.empty() && !match) {
+            size_t comma = list.find(',');
+            string_view tag = list.substr(0, comma);
+            list = comma == string_view::npos ? string_view() : list.substr(comma + 1);
+            while(!tag.empty() && tag.front() == ' ') { tag.remove_prefix(1); }
+            while(!tag.empty() && tag.back() == ' ') { tag.remove_suffix(1); }
+            if(tag.substr(0, 2) == "W/") { tag.remove_prefix(2); }
+            // 压缩版本的ETag是原文件的ETag加上编码名，客户端缓存的可能是其中任何一个它接受的版本
+            if(tag == "*" || tag == etag) {
+                match = true;
+            }
+            else if(vary) {
+                for(Compressor::ENCODING enc : { Compressor::GZIP, Compressor::BROTLI }) {
+                    if((acceptEncodings_ & (1u << enc)) && tag == EncodedETag(etag, enc)) {
+                        match = true;
+                    }
+                }
+            }
+            if(match) {
+                notModifiedTag_ = tag == "*" ? etag : string(tag);
+            }
+        }
+    }
+    else {
+        time_t since;
+        match = ParseHttpDate(ifModifiedSince_, &since) && st.st_mtime <= since;
+        // 不知道客户端缓存的是哪个编码版本，这时不回ETag
+        notModifiedTag_ = vary ? "" : etag;
+    }
+    if(match) {
+        mmFileStat_ = st;
+        vary_ = vary;
+    }
+    return match;
+}
+
+// 把请求的范围换算成闭区间并去掉不满足的，(-1, n)为最后n字节，(a, -1)为从a到结尾
+bool HttpResponse::ResolveRanges_() {
+    long long size = mmFileStat_.st_size;
+    vector<HttpRequest::ByteRange> resolved;
+    for(const auto& r : ranges_) {
+        long long first = r.first, last = r.second;
+        if(first < 0) {
+            if(last == 0 || size == 0) { continue; }
+            first = max(0LL, size - last);
+            last = size - 1;
+        }
+        else {
+            if(first >= size) { continue; }
+            if(last < 0 || last >= size) { last = size - 1; }
+        }
+        resolved.emplace_back(first, last);
+    }
+    ranges_.swap(resolved);
+    return !ranges_.empty();
 }
 
 // 返回文件内容的指针
 char* HttpResponse::File() {
-    return mmFile_;
+    return file_ ? file_->data : nullptr;
+}
+
+// 取打开好的文件；取不到时stat一次，让调用者区分404、403和打开失败（stat成功但file_为空）
+bool HttpResponse::OpenFile_() {
+    file_ = FileCache::Instance()->Get(srcDir_ + path_);
+    if(file_) {
+        mmFileStat_ = file_->st;
+        return true;
+    }
+    return stat((srcDir_ + path_).data(), &mmFileStat_) == 0;
 }
 
 // 返回文件内容的长度
@@ -98,7 +334,7 @@ size_t HttpResponse::FileLen() const {
 void HttpResponse::ErrorHtml_() {
     if(CODE_PATH.count(code_) == 1) {   //状态码存在
         path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+        OpenFile_();
     }
 }
 
@@ -115,6 +351,7 @@ void HttpResponse::AddStateLine_(Buffer& buff) {
 }
 
 void HttpResponse::AddHeader_(Buffer& buff) {
+    buff.Append("Date: " + LoopClock::Wall().httpDate + "\r\n");
     buff.Append("Connection: ");
     if(isKeepAlive_) {  
         buff.Append("keep-alive\r\n");
@@ -122,44 +359,152 @@ void HttpResponse::AddHeader_(Buffer& buff) {
     } else{
         buff.Append("close\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    if(file_ && (code_ == 200 || code_ == 206)) {
+        buff.Append("Accept-Ranges: bytes\r\n");
+        buff.Append("ETag: " + file_->etag + "\r\n");
+        buff.Append("Last-Modified: " + file_->lastModified + "\r\n");
+    }
+    if(vary_ && (code_ == 200 || code_ == 206 || code_ == 304)) {
+        buff.Append("Vary: Accept-Encoding\r\n");
+    }
+    if(encoding_ != Compressor::IDENTITY) {
+        buff.Append("Content-Encoding: " + string(Compressor::Name(encoding_)) + "\r\n");
+    }
+    if(code_ == 304) {
+        if(!notModifiedTag_.empty()) {
+            buff.Append("ETag: " + notModifiedTag_ + "\r\n");
+        }
+        buff.Append("Last-Modified: " + HttpDate(mmFileStat_.st_mtime) + "\r\n\r\n");
+        return; // 304没有消息体，也不需要Content-type和Content-length
+    }
+    if(code_ == 416) {
+        buff.Append("Content-Range: bytes */" + to_string(mmFileStat_.st_size) + "\r\n");
+    }
+    if(code_ == 503) {
+        buff.Append("Retry-After: 1\r\n");
+    }
+    if(code_ == 206 && ranges_.size() > 1) {
+        return; // multipart的Content-type在AddContent_中和分隔符一起生成
+    }
+    buff.Append("Content-type: " + (file_ ? file_->mime : GetFileType_()) + "\r\n");
 }
 
-// 将文件内容映射到内存中以提高文件的访问速度，并向HTTP响应中添加内容的相关信息
+// 文件已由FileCache打开并映射到内存中，这里只向HTTP响应中添加内容的相关信息
 void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(srcFd < 0) { 
-        ErrorContent(buff, "File NotFound!");
+    if(code_ == 304) {
+        return;
+    }
+    if(!file_) { 
+        ErrorContent(buff, code_ == 416 ? "Requested Range Not Satisfiable!" :
+                           code_ == 413 ? "Payload Too Large!" :
+                           code_ == 415 ? "Unsupported Media Type!" :
+                           code_ == 500 ? "Internal Server Error!" :
+                           code_ == 503 ? "Server Busy!" : "File NotFound!");
         return; 
     }
-
-    //将文件映射到内存提高文件的访问速度  MAP_PRIVATE 建立一个写入时拷贝的私有映射
     LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    // mmap函数将文件映射到内存中，0表示映射到任何可用地址，mmFileStat_.st_size表示文件长度，PROT_READ允许读取映射区的内容，MAP_PRIVATE建立一个写入时拷贝的私有映射，srcFd要映射的文件描述符，0表示映射文件的起始位置
-    if(*mmRet == -1) {
-        ErrorContent(buff, "File NotFound!");
-        return; 
+    string total = to_string(mmFileStat_.st_size);
+    if(code_ != 206) {
+        buff.Append("Content-length: " + total + "\r\n\r\n");
+        AddFile_(buff, 0, mmFileStat_.st_size);
+        return;
+    }
+    if(ranges_.size() == 1) {
+        size_t first = ranges_[0].first, last = ranges_[0].second;
+        buff.Append("Content-Range: bytes " + to_string(first) + "-" + to_string(last) + "/" + total + "\r\n");
+        buff.Append("Content-length: " + to_string(last - first + 1) + "\r\n\r\n");
+        AddFile_(buff, first, last - first + 1);
+        return;
     }
-    mmFile_ = (char*)mmRet; //指向映射区域的指针
-    close(srcFd);
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    // 多个范围：multipart/byteranges，先生成每段的小头部以便算出总长度
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "%016llx%08llx",
+             (unsigned long long)mmFileStat_.st_ino, (unsigned long long)mmFileStat_.st_mtime & 0xffffffff);
+    vector<string> partHeads;
+    size_t length = 0;
+    for(const auto& r : ranges_) {
+        partHeads.push_back(string("\r\n--") + boundary + "\r\nContent-type: " + file_->mime +
+                            "\r\nContent-Range: bytes " + to_string(r.first) + "-" + to_string(r.second) + "/" + total + "\r\n\r\n");
+        length += partHeads.back().size() + (r.second - r.first + 1);
+    }
+    string tail = string("\r\n--") + boundary + "--\r\n";
+    length += tail.size();
+    buff.Append(string("Content-type: multipart/byteranges; boundary=") + boundary + "\r\n");
+    buff.Append("Content-length: " + to_string(length) + "\r\n\r\n");
+    for(size_t i = 0; i < ranges_.size(); i++) {
+        buff.Append(partHeads[i]);
+        AddFile_(buff, ranges_[i].first, ranges_[i].second - ranges_[i].first + 1);
+    }
+    buff.Append(tail);
 }
 
-void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);   //释放之前映射的内存区域
-        mmFile_ = nullptr;
+void HttpResponse::EndText_(Buffer& buff) {
+    size_t end = buff.ReadableBytes();
+    if(end > textStart_) {
+        segments_.push_back({ true, textStart_, end - textStart_ });
     }
+    textStart_ = end;
+}
+
+void HttpResponse::AddFile_(Buffer& buff, size_t offset, size_t len) {
+    EndText_(buff);
+    if(len > 0) {
+        segments_.push_back({ false, offset, len });
+    }
+}
+
+bool HttpResponse::ParseHttpDate(const string& str, time_t* t) {
+    struct tm tm = {};
+    const char* end = strptime(str.data(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || *end != '\0') {
+        return false;
+    }
+    *t = timegm(&tm);
+    return true;
+}
+
+string HttpResponse::ETag(const struct stat& st) {
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "\"%llx-%llx\"",
+                       (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec,
+                       (unsigned long long)st.st_size);
+    return string(buf, len);
+}
+
+string HttpResponse::EncodedETag(const string& etag, Compressor::ENCODING enc) {
+    return etag.substr(0, etag.size() - 1) + "-" + Compressor::Name(enc) + "\"";
+}
+
+string HttpResponse::HttpDate(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[64];
+    size_t len = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return string(buf, len);
+}
+
+shared_ptr<const CachedFile> HttpResponse::DetachFile() {
+    shared_ptr<const CachedFile> file = move(file_);
+    file_.reset();
+    return file;
+}
+
+// 释放对文件的引用，最后一个引用释放时才真正munmap
+void HttpResponse::UnmapFile() {
+    file_.reset();
 }
 
 // 判断文件类型 根据文件的后缀来确定文件的内容类型
 string HttpResponse::GetFileType_() {
-    string::size_type idx = path_.find_last_of('.');    //找到最后一个点号的位置
+    return FileType(path_);
+}
+
+string HttpResponse::FileType(const string& path) {
+    string::size_type idx = path.find_last_of('.');    //找到最后一个点号的位置
     if(idx == string::npos) {   // 最大值 find函数在找不到指定值得情况下会返回string::npos
         return "text/plain";    //纯文本类型
     }
-    string suffix = path_.substr(idx);
+    string suffix = path.substr(idx);
     if(SUFFIX_TYPE.count(suffix) == 1) {
         return SUFFIX_TYPE.find(suffix)->second;
     }   //如果后缀存在，返回相对应的内容类型
@@ -6,29 +6,65 @@
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
 #include <sys/mman.h>    // mmap, munmap
+#include <time.h>        // gmtime_r, strftime
+#include <memory>
+#include <vector>
+#include <string_view>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../timer/loopclock.h"
+#include "filecache.h"
+#include "compressor.h"
+#include "httprequest.h"
 
 class HttpResponse {
 public:
+    // 响应报文按顺序由若干段组成：写缓冲区中的一段文本（头部、multipart分隔），或文件中的一段
+    struct Segment {
+        bool inBuff;    // true：写缓冲区中[offset, offset+len)，偏移相对于MakeResponse时的Peek()；false：文件中[offset, offset+len)
+        size_t offset;
+        size_t len;
+    };
+
     HttpResponse();
     ~HttpResponse();
 
     void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    void SetRange(const std::vector<HttpRequest::ByteRange>& ranges, std::string_view ifRange); // GET请求的Range和If-Range首部，在Init之后调用
     void MakeResponse(Buffer& buff);
+    void SetAcceptEncoding(std::string_view acceptEncoding);  // 按Accept-Encoding首部决定可以用的压缩编码
+    void SetConditional(std::string_view ifNoneMatch, std::string_view ifModifiedSince); // GET请求的条件首部，在Init之后调用
+    const std::vector<Segment>& Segments() const { return segments_; }  // MakeResponse生成的各段
+    bool InCache(size_t maxBytes) const;    // 生成响应不需要I/O：文件（要压缩时连同压缩结果）已在缓存中映射，且不超过maxBytes
     void UnmapFile();
+    std::shared_ptr<const CachedFile> DetachFile();  // 交出文件的引用，发送完之前映射保持有效
     char* File();
     size_t FileLen() const;
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; }
+    bool IsKeepAlive() const { return isKeepAlive_; }
+
+    static std::string FileType(const std::string& path);   // 根据后缀判断Content-type
+    static std::string HttpDate(time_t t);                  // RFC 7231的HTTP-date，如Sun, 06 Nov 1994 08:49:37 GMT
+    static bool ParseHttpDate(const std::string& str, time_t* t);
+    static std::string ETag(const struct stat& st);         // 由修改时间（纳秒）和大小生成的强ETag
+    static std::string EncodedETag(const std::string& etag, Compressor::ENCODING enc);  // 压缩版本的ETag，如"abc-gzip"
 
 private:
     void AddStateLine_(Buffer &buff);   //添加行
     void AddHeader_(Buffer &buff);      //添加头
     void AddContent_(Buffer &buff);     //添加消息体
+    void AddFile_(Buffer& buff, size_t offset, size_t len); // 在当前位置插入文件中的一段
+    void EndText_(Buffer& buff);        // 把textStart_之后追加的文本记为一段
+    static bool EqualsNoCase_(std::string_view a, std::string_view b);
+
+    void Encode_();         // 客户端接受时把文件换成压缩版本
+    bool NotModified_();    // 条件请求的验证器都匹配时返回true（304）
+    bool ResolveRanges_();  // 按文件大小计算要发送的范围，返回false表示一个都不满足（416）
 
     void ErrorHtml_();
+    bool OpenFile_();   // 从文件缓存中取文件，失败时只stat，用于判断404/403
     std::string GetFileType_();
 
     int code_;
@@ -37,9 +73,24 @@ private:
     std::string path_;     //响应路径
     std::string srcDir_;   //相应目录
     
-    char* mmFile_; 
+    std::shared_ptr<const CachedFile> file_;    // 打开并映射好的文件，来自FileCache
     struct stat mmFileStat_;    //文件的元数据信息，包括文件的类型和访问权限st_mode、文件的大小 st_size
 
+    std::vector<HttpRequest::ByteRange> ranges_;  // 请求的范围，解析后变为闭区间[first, last]
+    std::string ifRange_;
+    std::string ifNoneMatch_;
+    std::string ifModifiedSince_;
+    unsigned acceptEncodings_;  // 客户端接受的编码，按位(1 << Compressor::ENCODING)
+    Compressor::ENCODING preferred_[2];     // 接受的压缩编码，按客户端的偏好排好
+    int preferredCnt_;
+    Compressor::ENCODING encoding_; // 实际使用的编码
+    bool vary_;                 // 响应内容随Accept-Encoding变化，需要Vary首部
+    std::string notModifiedTag_;    // 304中回给客户端的ETag，即它所缓存的那个版本
+    std::vector<Segment> segments_;
+    size_t textStart_;      // 还没记入segments_的文本在写缓冲区中的起点
+
+    static const size_t MAX_RANGES = 16;    // 超过这么多段的Range请求按普通请求处理，防止放大攻击
+
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;  // 后缀类型集
     static const std::unordered_map<int, std::string> CODE_STATUS;          // 编码状态集
     static const std::unordered_map<int, std::string> CODE_PATH;            // 编码路径集
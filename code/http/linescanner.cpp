@@ -0,0 +1,206 @@
+#include "linescanner.h"
+#include <string.h>     // memchr
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINE_SCANNER_X86
+#endif
+
+namespace {
+// 扫描到一半的状态：已经找到的行和正在找的这一行
+struct State {
+    LineScanner::Line* lines;
+    size_t max;
+    size_t n;
+    LineScanner::Line cur;
+};
+
+// 64字节一块的比较结果，第i位对应第i个字节
+struct Masks {
+    uint64_t lf;        // '\n'
+    uint64_t colon;     // ':'
+    uint64_t space;     // ' '
+};
+
+inline void Mark(uint32_t& slot, uint64_t mask, size_t pos) {
+    if(slot == LineScanner::NPOS && mask) {
+        slot = static_cast<uint32_t>(pos + __builtin_ctzll(mask));
+    }
+}
+
+/*
+按64字节对齐的块扫描，Block(p)给出这一块'\n'、':'、' '的位掩码，Block.Lf(p)只给'\n'
+块内按行处理：下一个'\n'之前的部分里取最低位就是这一行第一个':'和' '，不逐个判断分隔符
+当前行的':'和' '都找到了以后只比较'\n'（长Cookie之类的行大部分字节这样跳过）
+块总是按64字节对齐读取，首尾超出[data, data+len)的字节用掩码去掉：对齐的块不会跨页，不需要复制尾部，
+也没有跨缓存行的非对齐读取。越界读取的字节不参与结果，但ASan会报，所以读数据的函数都不插桩（和glibc的memchr同样的做法）
+*/
+template<typename Block>
+__attribute__((always_inline)) inline void ScanBlocks(const char* data, size_t len, size_t from, State& st, Block block) {
+    LineScanner::Line cur = st.cur;
+    LineScanner::Line* lines = st.lines;
+    size_t cnt = st.n;
+    const size_t max = st.max;
+    const char* end = data + len;
+    const char* p = reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(data + from) & ~uintptr_t(63));
+    uint64_t valid = ~uint64_t(0) << (data + from - p);    // 第一块去掉from之前的字节
+    while(p < end) {
+        Masks m = block(p);
+        if(end - p < 64) {
+            valid &= (uint64_t(1) << (end - p)) - 1;
+        }
+        m.lf &= valid;
+        m.colon &= valid;
+        m.space &= valid;
+        valid = ~uint64_t(0);
+        size_t pos = static_cast<size_t>(p - data);     // 第一块可能在data之前，按无符号数回绕，加上位下标后正确
+        while(m.lf) {
+            uint64_t low = m.lf & (0 - m.lf);   // 这一行的'\n'
+            uint64_t line = low - 1;            // 它之前的位，前面的行已经从colon/space里清掉
+            Mark(cur.colon, m.colon & line, pos);
+            Mark(cur.space, m.space & line, pos);
+            cur.end = static_cast<uint32_t>(pos + __builtin_ctzll(low));
+            lines[cnt++] = cur;
+            cur = { cur.end + 1, 0, LineScanner::NPOS, LineScanner::NPOS };
+            if(cnt == max) {
+                st.n = cnt;
+                return;
+            }
+            line |= low;
+            m.lf &= ~line;
+            m.colon &= ~line;
+            m.space &= ~line;
+        }
+        Mark(cur.colon, m.colon, pos);
+        Mark(cur.space, m.space, pos);
+        p += 64;
+        if(cur.colon != LineScanner::NPOS && cur.space != LineScanner::NPOS) {
+            while(p + 64 <= end && !block.Lf(p)) { p += 64; }
+        }
+    }
+    st.n = cnt;
+    st.cur = cur;
+}
+
+struct ScalarBlock {
+    __attribute__((no_sanitize_address)) uint64_t Lf(const char* p) const {
+        return memchr(p, '\n', 64) != nullptr;
+    }
+    __attribute__((no_sanitize_address)) Masks operator()(const char* p) const {
+        Masks m = { 0, 0, 0 };
+        for(int i = 0; i < 64; i++) {
+            m.lf |= uint64_t(p[i] == '\n') << i;
+            m.colon |= uint64_t(p[i] == ':') << i;
+            m.space |= uint64_t(p[i] == ' ') << i;
+        }
+        return m;
+    }
+};
+
+#ifdef LINE_SCANNER_X86
+struct Sse2Block {
+    __attribute__((target("sse2"), no_sanitize_address)) uint64_t Lf(const char* p) const {
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i* v = reinterpret_cast<const __m128i*>(p);
+        __m128i a = _mm_or_si128(_mm_cmpeq_epi8(_mm_load_si128(v), lf), _mm_cmpeq_epi8(_mm_load_si128(v + 1), lf));
+        __m128i b = _mm_or_si128(_mm_cmpeq_epi8(_mm_load_si128(v + 2), lf), _mm_cmpeq_epi8(_mm_load_si128(v + 3), lf));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(a, b)));
+    }
+    __attribute__((target("sse2"), no_sanitize_address)) Masks operator()(const char* p) const {
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i colon = _mm_set1_epi8(':');
+        const __m128i space = _mm_set1_epi8(' ');
+        Masks m = { 0, 0, 0 };
+        for(int i = 0; i < 4; i++) {
+            __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(p + i * 16));
+            m.lf |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf)))) << (i * 16);
+            m.colon |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, colon)))) << (i * 16);
+            m.space |= uint64_t(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, space)))) << (i * 16);
+        }
+        return m;
+    }
+};
+
+struct Avx2Block {
+    __attribute__((target("avx2"), no_sanitize_address)) static uint64_t Match(__m256i lo, __m256i hi, char ch) {
+        const __m256i c = _mm256_set1_epi8(ch);
+        return uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, c)))) |
+               uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, c)))) << 32;
+    }
+    __attribute__((target("avx2"), no_sanitize_address)) uint64_t Lf(const char* p) const {
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const __m256i* v = reinterpret_cast<const __m256i*>(p);
+        __m256i x = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_load_si256(v), lf), _mm256_cmpeq_epi8(_mm256_load_si256(v + 1), lf));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(x));
+    }
+    __attribute__((target("avx2"), no_sanitize_address)) Masks operator()(const char* p) const {
+        __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(p + 32));
+        return { Match(lo, hi, '\n'), Match(lo, hi, ':'), Match(lo, hi, ' ') };
+    }
+};
+
+__attribute__((target("sse2"), no_sanitize_address))
+void ScanSse2(const char* data, size_t len, size_t from, State& st) {
+    ScanBlocks(data, len, from, st, Sse2Block());
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+void ScanAvx2(const char* data, size_t len, size_t from, State& st) {
+    ScanBlocks(data, len, from, st, Avx2Block());
+}
+#endif
+
+__attribute__((no_sanitize_address))
+void ScanScalar(const char* data, size_t len, size_t from, State& st) {
+    ScanBlocks(data, len, from, st, ScalarBlock());
+}
+}
+
+size_t LineScanner::Scan(const char* data, size_t len, size_t from, Line* lines, size_t max) {
+    return Scan(Best(), data, len, from, lines, max);
+}
+
+size_t LineScanner::Scan(IMPL impl, const char* data, size_t len, size_t from, Line* lines, size_t max) {
+    len = std::min<size_t>(len, NPOS - 1);  // 偏移用32位表示
+    from = std::min(from, len);
+    State st = { lines, max, 0, { 0, 0, NPOS, NPOS } };
+    if(max == 0) {
+        return 0;
+    }
+    // 上次扫过的部分没有换行，只补查第一行的':'和' '
+    if(from > 0) {
+        const char* colon = static_cast<const char*>(memchr(data, ':', from));
+        const char* space = static_cast<const char*>(memchr(data, ' ', from));
+        if(colon) { st.cur.colon = static_cast<uint32_t>(colon - data); }
+        if(space) { st.cur.space = static_cast<uint32_t>(space - data); }
+    }
+#ifdef LINE_SCANNER_X86
+    if(impl == AVX2) {
+        ScanAvx2(data, len, from, st);
+    } else if(impl == SSE2) {
+        ScanSse2(data, len, from, st);
+    } else {
+        ScanScalar(data, len, from, st);
+    }
+#else
+    (void)impl;
+    ScanScalar(data, len, from, st);
+#endif
+    return st.n;
+}
+
+LineScanner::IMPL LineScanner::Best() {
+#ifdef LINE_SCANNER_X86
+    static const IMPL best = __builtin_cpu_supports("avx2") ? AVX2 : (__builtin_cpu_supports("sse2") ? SSE2 : SCALAR);
+    return best;
+#else
+    return SCALAR;
+#endif
+}
+
+const char* LineScanner::Name(IMPL impl) {
+    static const char* NAME[] = { "scalar", "sse2", "avx2" };
+    return NAME[impl];
+}
@@ -0,0 +1,39 @@
+#ifndef LINE_SCANNER_H
+#define LINE_SCANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+请求行和首部的分隔符扫描：一遍扫过数据，同时找出'\n'、':'和' '，生成每一行的边界和字段分隔位置
+每64字节比较一次得到三个位掩码（x86上按CPU支持用AVX2或SSE2，其他平台逐字节），一块里的多行靠位运算拆开，
+不用对每一行各调一次memchr；一行的分隔符都找到后剩下的部分每块只比较'\n'，跳到行尾
+块按64字节对齐读取，会读到[data, data+len)前后同一块里的字节（不跨页），结果里不包含它们
+*/
+class LineScanner {
+public:
+    enum IMPL {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    // 一个完整的行，位置都是相对于扫描起点的偏移
+    struct Line {
+        uint32_t begin;     // 行首
+        uint32_t end;       // '\n'的位置，行内容为[begin, end)，可能以'\r'结尾
+        uint32_t colon;     // 行内第一个':'，没有时为NPOS
+        uint32_t space;     // 行内第一个' '，没有时为NPOS
+    };
+    static const uint32_t NPOS = UINT32_MAX;
+
+    // 扫描[data, data+len)，第一行从data开始，最多找出max个以'\n'结束的行，返回找到的行数
+    // [data, data+from)是上次扫描过、已知没有'\n'的部分，不再找换行，只补查第一行的':'和' '
+    static size_t Scan(const char* data, size_t len, size_t from, Line* lines, size_t max);
+    static size_t Scan(IMPL impl, const char* data, size_t len, size_t from, Line* lines, size_t max);
+
+    static IMPL Best();     // 运行时检测到的最快实现
+    static const char* Name(IMPL impl);
+};
+
+#endif //LINE_SCANNER_H
@@ -0,0 +1,209 @@
+#include "multipartparser.h"
+#include <string.h>     // memmem, memchr
+#include <strings.h>    // strncasecmp
+#include <algorithm>
+using namespace std;
+
+static bool EqualsNoCase(string_view a, string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+static string_view Trim(string_view s) {
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) { s.remove_prefix(1); }
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) { s.remove_suffix(1); }
+    return s;
+}
+
+// 从 type; a=1; b="x;y" 这样的首部值里取参数，引号里的内容原样返回，没有时返回空
+static string_view Param(string_view value, string_view key) {
+    size_t i = value.find(';');
+    while(i != string_view::npos) {
+        size_t eq = value.find('=', i + 1);
+        if(eq == string_view::npos) { break; }
+        string_view name = Trim(value.substr(i + 1, eq - i - 1));
+        string_view v;
+        size_t start = eq + 1;
+        while(start < value.size() && (value[start] == ' ' || value[start] == '\t')) { start++; }
+        if(start < value.size() && value[start] == '"') {
+            size_t close = value.find('"', start + 1);
+            if(close == string_view::npos) { break; }
+            v = value.substr(start + 1, close - start - 1);
+            i = value.find(';', close);
+        } else {
+            i = value.find(';', start);
+            v = Trim(value.substr(start, i == string_view::npos ? string_view::npos : i - start));
+        }
+        if(EqualsNoCase(name, key)) {
+            return v;
+        }
+    }
+    return string_view();
+}
+
+MultipartParser::MultipartParser(BeginCallback onBegin, DataCallback onData, EndCallback onEnd)
+    : onBegin_(onBegin), onData_(onData), onEnd_(onEnd), state_(NONE), prev_(0) {}
+
+string_view MultipartParser::Boundary(string_view contentType) {
+    string_view type = Trim(contentType.substr(0, contentType.find(';')));
+    if(!EqualsNoCase(type, "multipart/form-data")) {
+        return string_view();
+    }
+    string_view boundary = Param(contentType, "boundary");
+    if(boundary.size() > MAX_BOUNDARY || boundary.find_first_of("\r\n") != string_view::npos) {
+        return string_view();
+    }
+    return boundary;
+}
+
+void MultipartParser::Reset(string_view boundary) {
+    delim_.assign("\r\n--");
+    delim_.append(boundary.data(), boundary.size());
+    tail_.assign("\r\n");   // 第一个分隔符在消息体开头时前面没有换行，当作已经收到了
+    headers_.clear();
+    prev_ = 0;
+    state_ = PREAMBLE;
+}
+
+void MultipartParser::Clear() {
+    state_ = NONE;
+    tail_.clear();
+    headers_.clear();
+}
+
+bool MultipartParser::Feed(const char* data, size_t len) {
+    while(len > 0) {
+        switch(state_) {
+        case PREAMBLE:
+        case BODY: {
+            size_t used = 0;
+            if(!Scan_(data, len, used)) { return false; }
+            data += used;
+            len -= used;
+            break;
+        }
+        case AFTER_BOUNDARY: {
+            char ch = *data++;
+            len--;
+            if(prev_ == '-') {
+                if(ch != '-') { return false; }
+                state_ = END;
+            } else if(prev_ == '\r') {
+                if(ch != '\n') { return false; }
+                headers_.assign("\r\n");    // 首部为空时紧接着就是一个空行，统一按"\r\n\r\n"找结尾
+                state_ = HEADERS;
+            } else if(ch == '-' || ch == '\r') {
+                prev_ = ch;
+            } else if(ch != ' ' && ch != '\t') {
+                return false;
+            }
+            break;
+        }
+        case HEADERS: {
+            size_t old = headers_.size();
+            size_t n = min(len, MAX_HEADER + 4 - old);
+            headers_.append(data, n);
+            size_t end = headers_.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if(end == string::npos) {
+                if(headers_.size() > MAX_HEADER) { return false; }
+                data += n;
+                len -= n;
+                break;
+            }
+            size_t used = end + 4 - old;
+            data += used;
+            len -= used;
+            string_view block = end >= 2 ? string_view(headers_).substr(2, end - 2) : string_view();   // 去掉补上的"\r\n"
+            if(!ParseHeaders_(block) || !onBegin_(part_)) {
+                return false;
+            }
+            state_ = BODY;
+            break;
+        }
+        case END:
+            return true;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// tail_为空时在data里找完整的分隔符；结尾处可能是分隔符前半截的部分留在tail_里等下一段
+// 分隔符里只有开头是'\r'（boundary不能含'\r'），所以tail_和后面的数据对不上时，它整个都是数据
+bool MultipartParser::Scan_(const char* data, size_t len, size_t& used) {
+    const bool body = (state_ == BODY);
+    if(!tail_.empty()) {
+        size_t t = tail_.size();
+        size_t n = min(len, delim_.size() - t);
+        if(memcmp(data, delim_.data() + t, n) == 0) {
+            used = n;
+            if(t + n < delim_.size()) {
+                tail_.append(data, n);
+                return true;
+            }
+            tail_.clear();
+            return Boundary_();
+        }
+        if(body && !onData_(tail_.data(), t)) { return false; }
+        tail_.clear();
+        used = 0;
+        return true;
+    }
+    const char* hit = static_cast<const char*>(memmem(data, len, delim_.data(), delim_.size()));
+    if(hit) {
+        size_t n = hit - data;
+        if(body && n > 0 && !onData_(data, n)) { return false; }
+        used = n + delim_.size();
+        return Boundary_();
+    }
+    size_t keep = 0;
+    const char* end = data + len;
+    for(const char* p = data + (len >= delim_.size() ? len - delim_.size() + 1 : 0);
+        (p = static_cast<const char*>(memchr(p, '\r', end - p))) != nullptr; p++) {
+        if(memcmp(p, delim_.data(), end - p) == 0) {
+            keep = end - p;
+            break;
+        }
+    }
+    if(body && len > keep && !onData_(data, len - keep)) { return false; }
+    tail_.assign(end - keep, keep);
+    used = len;
+    return true;
+}
+
+bool MultipartParser::Boundary_() {
+    if(state_ == BODY && !onEnd_()) {
+        return false;
+    }
+    prev_ = 0;
+    state_ = AFTER_BOUNDARY;
+    return true;
+}
+
+// 部分的首部：必须有Content-Disposition: form-data; name="..."，可以有filename和Content-Type
+bool MultipartParser::ParseHeaders_(string_view block) {
+    part_.name.clear();
+    part_.filename.clear();
+    part_.contentType.clear();
+    bool disposition = false;
+    while(!block.empty()) {
+        size_t eol = block.find("\r\n");
+        string_view line = block.substr(0, eol);
+        block = eol == string_view::npos ? string_view() : block.substr(eol + 2);
+        size_t colon = line.find(':');
+        if(colon == string_view::npos) { return false; }
+        string_view key = Trim(line.substr(0, colon));
+        string_view value = Trim(line.substr(colon + 1));
+        if(EqualsNoCase(key, "Content-Disposition")) {
+            if(!EqualsNoCase(Trim(value.substr(0, value.find(';'))), "form-data")) { return false; }
+            string_view name = Param(value, "name");
+            string_view filename = Param(value, "filename");
+            part_.name.assign(name.data(), name.size());
+            part_.filename.assign(filename.data(), filename.size());
+            disposition = true;
+        } else if(EqualsNoCase(key, "Content-Type")) {
+            part_.contentType.assign(value.data(), value.size());
+        }
+    }
+    return disposition && !part_.name.empty();
+}
@@ -0,0 +1,69 @@
+#ifndef MULTIPART_PARSER_H
+#define MULTIPART_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <stddef.h>
+
+/*
+multipart/form-data消息体的增量解析：数据到多少喂多少，分隔符、部分的首部可以在任意位置被读断开
+每个部分开始时回调一次首部信息，数据按到达的顺序一段段交出去，不在内存里攒整个部分
+占用的内存有上限：部分的首部最多MAX_HEADER字节，加上可能是分隔符前半截的几十个字节
+*/
+class MultipartParser {
+public:
+    struct Part {
+        std::string name;           // Content-Disposition的name
+        std::string filename;       // Content-Disposition的filename，普通表单字段为空
+        std::string contentType;
+    };
+
+    // 回调返回false时停止解析，Feed返回false
+    typedef std::function<bool(const Part& part)> BeginCallback;
+    typedef std::function<bool(const char* data, size_t len)> DataCallback;
+    typedef std::function<bool()> EndCallback;
+
+    MultipartParser(BeginCallback onBegin, DataCallback onData, EndCallback onEnd);
+
+    // Content-Type为multipart/form-data时返回boundary参数，否则或boundary不合法时返回空
+    static std::string_view Boundary(std::string_view contentType);
+
+    void Reset(std::string_view boundary);  // 开始解析一个新的消息体
+    void Clear();                           // 不再解析，Active()为false
+    bool Feed(const char* data, size_t len);   // 格式错误或回调返回false时返回false
+
+    bool Active() const { return state_ != NONE; }
+    bool Done() const { return state_ == END; }     // 收到了结束分隔符
+    const Part& part() const { return part_; }      // 当前部分
+
+    static const size_t MAX_HEADER = 8192;      // 一个部分的首部的最大长度
+    static const size_t MAX_BOUNDARY = 70;      // RFC 2046规定的boundary最大长度
+
+private:
+    enum STATE {
+        NONE,
+        PREAMBLE,       // 第一个分隔符之前的内容，丢弃
+        AFTER_BOUNDARY, // 分隔符后面：--表示结束，否则到行尾
+        HEADERS,        // 部分的首部，到空行结束
+        BODY,           // 部分的数据，到下一个分隔符结束
+        END,            // 结束分隔符之后的内容，丢弃
+    };
+
+    bool Scan_(const char* data, size_t len, size_t& used);    // PREAMBLE/BODY状态下找分隔符
+    bool Boundary_();                                           // 找到一个分隔符
+    bool ParseHeaders_(std::string_view block);
+
+    BeginCallback onBegin_;
+    DataCallback onData_;
+    EndCallback onEnd_;
+
+    STATE state_;
+    std::string delim_;     // "\r\n--" + boundary
+    std::string tail_;      // 上一段结尾处分隔符的前半截，还不知道是不是数据
+    std::string headers_;   // 正在收的部分首部
+    char prev_;             // AFTER_BOUNDARY状态下收到的'-'或'\r'
+    Part part_;
+};
+
+#endif //MULTIPART_PARSER_H
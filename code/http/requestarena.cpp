@@ -0,0 +1,37 @@
+#include "requestarena.h"
+#include <string.h>     // memcpy
+#include <algorithm>
+
+RequestArena::RequestArena() : cur_(inline_), end_(inline_ + INLINE_SIZE), used_(0) {}
+
+RequestArena::~RequestArena() {
+    Reset();
+}
+
+char* RequestArena::Alloc(size_t len) {
+    if(static_cast<size_t>(end_ - cur_) < len) {
+        Slab* slab = BufferArena::Get(std::max(len, Slab::SIZE));
+        slabs_.push_back(slab);
+        cur_ = slab->Data();
+        end_ = cur_ + slab->cap;
+    }
+    char* p = cur_;
+    cur_ += len;
+    used_ += len;
+    return p;
+}
+
+std::string_view RequestArena::Copy(std::string_view str) {
+    if(str.empty()) { return std::string_view(); }
+    char* p = Alloc(str.size());
+    memcpy(p, str.data(), str.size());
+    return std::string_view(p, str.size());
+}
+
+void RequestArena::Reset() {
+    for(Slab* slab : slabs_) { BufferArena::Put(slab); }
+    slabs_.clear();
+    cur_ = inline_;
+    end_ = inline_ + INLINE_SIZE;
+    used_ = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <string_view>
+#include <vector>
+#include <stddef.h>
+
+#include "../buffer/bufferarena.h"
+
+/*
+一个请求的单调内存：方法、版本、首部的名字和值都拷到这里，Reset之前不释放也不搬动，string_view可以一直指着
+先用对象里自带的INLINE_SIZE字节，不够时从BufferArena取块接着用；Reset把取来的块还回去，回到自带空间的开头
+典型的GET请求只用自带的空间，解析时不碰堆
+*/
+class RequestArena {
+public:
+    RequestArena();
+    ~RequestArena();
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    char* Alloc(size_t len);                        // 取len字节，不对齐（只放字符）
+    std::string_view Copy(std::string_view str);    // 拷一份，返回指向副本的视图
+    void Reset();                                   // 之前返回的内存全部作废
+    size_t Used() const { return used_; }           // Reset以来分出去的字节数
+
+    static const size_t INLINE_SIZE = 1024;
+
+private:
+    char inline_[INLINE_SIZE];
+    char* cur_;     // 当前块里下一个可用的位置
+    char* end_;     // 当前块的结尾
+    size_t used_;
+    std::vector<Slab*> slabs_;  // 自带空间之后取的块，Reset时还给BufferArena
+};
+
+#endif //REQUEST_ARENA_H
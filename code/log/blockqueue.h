@@ -49,10 +49,11 @@ BlockQueue<T>::~BlockQueue() {
 
 template<typename T>
 void BlockQueue<T>::Close() {
-    // lock_guard<mutex> locker(mtx_); // 操控队列之前，都需要上锁
-    // deq_.clear();                   // 清空队列
-    clear();
-    isClose_ = true;
+    {
+        lock_guard<mutex> locker(mtx_); // 在锁里设置关闭标志，等待中的消费者醒来一定能看到
+        deq_.clear();
+        isClose_ = true;
+    }
     condConsumer_.notify_all(); //通知所有等待在条件变量上的线程，它们都会被唤醒，然后竞争条件变量的锁
     condProducer_.notify_all();
 }
@@ -102,6 +103,9 @@ template<typename T>
 bool BlockQueue<T>::pop(T& item) {
     unique_lock<mutex> locker(mtx_);
     while(deq_.empty()) {
+        if(isClose_) {
+            return false;               // 队列已关闭，让写线程退出
+        }
         condConsumer_.wait(locker);     // 队列空了，需要等待
     }
     item = deq_.front();
@@ -107,11 +107,9 @@ void Log::init(int level, const char* path, const char* suffix, int maxQueCapaci
 }
 
 void Log::write(int level, const char *format, ...) {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, nullptr);
-    time_t tSec = now.tv_sec;
-    struct tm *sysTime = localtime(&tSec);  //使用localtime函数将秒数转换为本地时间
-    struct tm t = *sysTime;
+    // 事件循环缓存的时间，本地时间和行首的时间串每秒才格式化一次
+    const LoopClock::WallTime& now = LoopClock::Wall();
+    const struct tm& t = now.local;
     va_list vaList; //va_list是用于处理可变数量参数的数据类型
 
     // 判断是否需要切换到新的日志文件，成立的情况：当前日期与toDay_不一致，写入的日志行数lineCount_大于0并且达到了最大行限制
@@ -150,9 +148,7 @@ void Log::write(int level, const char *format, ...) {
     {
         unique_lock<mutex> locker(mtx_);
         lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
+        int n = snprintf(buff_.BeginWrite(), 128, "%s.%06ld ", now.logStamp, now.usec);
                     
         buff_.HasWritten(n);
         AppendLogLevelTitle_(level);    //添加日志等级
@@ -3,9 +3,14 @@
 
 int main() {
     // 守护进程 后台运行 
-    WebServer server(
-        1316, 3, 60000,              // 端口 ET模式 timeoutMs 
-        3306, "root", "990815", "webserver", /* Mysql配置 */
-        12, 8, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+    WebServer::Config config;           // 没有设置的字段用默认值，见WebServer::Config
+    config.port = 1316;
+    config.trigMode = 3;                // ET模式
+    config.reactorNum = 0;              // Reactor数量(0为单Reactor+线程池)
+    config.sqlUser = "root";            /* Mysql配置 */
+    config.sqlPwd = "990815";
+    config.dbName = "webserver";
+    config.uploadDir = nullptr;         // 上传文件目录(nullptr为不接受上传)
+    WebServer server(config);
     server.Start();
 } 
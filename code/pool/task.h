@@ -0,0 +1,104 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <new>          // placement new
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+#include <assert.h>
+
+/*
+只能移动的任务类型，可调用对象直接放在对象内部的固定缓冲区里，构造、移动、执行都不分配内存
+缓冲区按服务器的回调设计：std::bind(&WebServer::OnRead_, this, reactor, client, gen)这样的绑定对象放得下
+放不下的可调用对象在编译期报错，而不是悄悄退化成堆分配
+整个对象占一个缓存行，在线程池的环形队列里按值存放
+*/
+class Task {
+public:
+    static const size_t INLINE_SIZE = 64 - sizeof(void*);
+
+    Task() noexcept : ops_(nullptr) {}
+    Task(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+    template<typename F, typename D = typename std::decay<F>::type,
+             typename = typename std::enable_if<!std::is_same<D, Task>::value>::type>
+    Task(F&& f) : ops_(&Ops_<D>::table) {
+        static_assert(sizeof(D) <= INLINE_SIZE, "callable too large for Task inline storage");
+        static_assert(alignof(D) <= alignof(Storage), "callable over-aligned for Task inline storage");
+        static_assert(std::is_nothrow_move_constructible<D>::value, "callable must be nothrow movable");
+        new (&storage_) D(std::forward<F>(f));
+    }
+
+    Task(Task&& other) noexcept : ops_(other.ops_) {
+        if(ops_) {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            Reset_();
+            if(other.ops_) {
+                other.ops_->move(&storage_, &other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) noexcept {
+        Reset_();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { Reset_(); }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    void operator()() {
+        assert(ops_);
+        ops_->invoke(&storage_);
+    }
+
+private:
+    typedef typename std::aligned_storage<INLINE_SIZE, alignof(void*)>::type Storage;
+
+    // 每种可调用类型一张操作表，Task里只存一个指针
+    struct OpsTable {
+        void (*invoke)(void* self);
+        void (*move)(void* dst, void* src);     // 移动构造到dst并析构src
+        void (*destroy)(void* self);
+    };
+
+    template<typename D>
+    struct Ops_ {
+        static void Invoke(void* self) { (*static_cast<D*>(self))(); }
+        static void Move(void* dst, void* src) {
+            D* s = static_cast<D*>(src);
+            new (dst) D(std::move(*s));
+            s->~D();
+        }
+        static void Destroy(void* self) { static_cast<D*>(self)->~D(); }
+        static const OpsTable table;
+    };
+
+    void Reset_() noexcept {
+        if(ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    const OpsTable* ops_;
+    Storage storage_;
+};
+
+template<typename D>
+const Task::OpsTable Task::Ops_<D>::table = { &Ops_<D>::Invoke, &Ops_<D>::Move, &Ops_<D>::Destroy };
+
+#endif //TASK_H
@@ -0,0 +1,292 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+
+ThreadPool::ThreadPool(int threadCount) : ThreadPool(threadCount, threadCount) {}
+
+ThreadPool::ThreadPool(int minThreads, int maxThreads, int growWaitMS, int idleMS) :
+        minThreads_(minThreads), maxThreads_(std::max(minThreads, maxThreads)),
+        growWaitMS_(growWaitMS), idleMS_(idleMS), global_(GLOBAL_CAPACITY), nextWorker_(0),
+        threadCount_(0), overflowSize_(0), searching_(0), sleepers_(0), isClosed_(false),
+        maxWaitMS_(0), lastMaxWaitMS_(0), grown_(0), shrunk_(0), queueLimit_(0), rejected_(0) {
+    assert(minThreads > 0 && growWaitMS > 0);
+    for(int i = 0; i < maxThreads_; i++) {
+        workers_.emplace_back(new Worker(LOCAL_CAPACITY));
+    }
+    // 所有本地队列建好后再启动线程，窃取时会遍历workers_
+    for(int i = 0; i < minThreads_; i++) {
+        Start_(i);
+    }
+    if(maxThreads_ > minThreads_) {
+        monitor_ = std::thread(&ThreadPool::Monitor_, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    isClosed_ = true;
+    {
+        std::lock_guard<std::mutex> locker(monitorMtx_);
+    }
+    monitorCond_.notify_all();
+    if(monitor_.joinable()) { monitor_.join(); }   // 先停掉监控线程，之后不会再有新线程
+    {
+        std::lock_guard<std::mutex> locker(parkMtx_);
+    }
+    parkCond_.notify_all();     // 唤醒所有的线程
+    for(auto& worker : workers_) {
+        if(worker->thread.joinable()) { worker->thread.join(); }
+    }
+}
+
+void ThreadPool::Push_(Task& task) {
+    Job job(std::move(task), NowMS_());
+    Inject_(job);
+    // 和睡眠前的检查配对：要么这里看到有线程睡眠，要么它睡前看到这个任务
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(searching_.load() == 0 && sleepers_.load() > 0) {
+        Wake_(1);
+    }
+}
+
+void ThreadPool::Inject_(Job& job) {
+    if(!global_.TryPush(job)) {
+        std::lock_guard<std::mutex> locker(overflowMtx_);
+        overflow_.push_back(std::move(job));
+        overflowSize_++;
+    }
+}
+
+void ThreadPool::AddTasks(Task* tasks, size_t n) {
+    if(n == 0) { return; }
+    int64_t now = NowMS_();
+    size_t batches = std::min(static_cast<size_t>(threadCount_.load()), n);
+    size_t per = (n + batches - 1) / batches;
+    for(size_t done = 0; done < n; ) {
+        size_t cnt = std::min(per, n - done);
+        Task* batch = tasks + done;
+        size_t pushed = workers_[NextWorker_()]->local.TryPushBatch(batch, cnt, now);
+        if(pushed < cnt) {
+            pushed += global_.TryPushBatch(batch + pushed, cnt - pushed, now);    // 本地队列满了放进注入队列
+        }
+        if(pushed < cnt) {
+            std::lock_guard<std::mutex> locker(overflowMtx_);
+            for(; pushed < cnt; pushed++) {
+                overflow_.emplace_back(std::move(batch[pushed]), now);
+                overflowSize_++;
+            }
+        }
+        done += cnt;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 正在自旋的线程会自己找到任务，只给剩下的批叫醒睡眠的线程
+    int need = std::min<int>(static_cast<int>(batches) - searching_.load(), sleepers_.load());
+    if(need > 0) {
+        Wake_(need);
+    }
+}
+
+// 轮到的槽位上没有线程就往后找；线程刚退出时放进去的任务仍然可以被别的线程偷走
+size_t ThreadPool::NextWorker_() {
+    size_t n = workers_.size();
+    size_t idx = 0;
+    for(size_t i = 0; i < n; i++) {
+        idx = nextWorker_.fetch_add(1, std::memory_order_relaxed) % n;
+        if(workers_[idx]->running.load(std::memory_order_relaxed)) { break; }
+    }
+    return idx;
+}
+
+void ThreadPool::Wake_(int n) {
+    {
+        std::lock_guard<std::mutex> locker(parkMtx_);   // 保证不会在线程检查完队列、还没wait的间隙通知
+    }
+    if(n >= sleepers_.load()) {
+        parkCond_.notify_all();
+    } else {
+        for(int i = 0; i < n; i++) { parkCond_.notify_one(); }
+    }
+}
+
+bool ThreadPool::HasWork_() const {
+    if(!global_.Empty() || overflowSize_.load() > 0) {
+        return true;
+    }
+    for(const auto& worker : workers_) {
+        if(!worker->local.Empty()) { return true; }
+    }
+    return false;
+}
+
+size_t ThreadPool::Queued_() const {
+    size_t queued = global_.Size() + overflowSize_.load();
+    for(const auto& worker : workers_) {
+        queued += worker->local.Size();
+    }
+    return queued;
+}
+
+bool ThreadPool::Pop_(size_t self, Job& job) {
+    Worker& worker = *workers_[self];
+    if(worker.local.TryPop(job)) {
+        return true;
+    }
+    if(global_.TryPop(job)) {
+        // 按线程数均分注入队列里剩下的任务，多取的放进本地队列，别的线程可以偷
+        size_t extra = std::min<size_t>(BATCH - 1, global_.Size() / threadCount_.load());
+        Job more;
+        for(size_t i = 0; i < extra && global_.TryPop(more); i++) {
+            if(!worker.local.TryPush(more)) {
+                Inject_(more);
+                break;
+            }
+        }
+        return true;
+    }
+    if(overflowSize_.load() > 0) {
+        std::lock_guard<std::mutex> locker(overflowMtx_);
+        if(!overflow_.empty()) {
+            job = std::move(overflow_.front());
+            overflow_.pop_front();
+            overflowSize_--;
+            return true;
+        }
+    }
+    return Steal_(self, job);
+}
+
+// 从别的槽位的本地队列偷一个任务，从下一个开始轮询，避免总是偷同一个；没有线程的槽位也要看
+bool ThreadPool::Steal_(size_t self, Job& job) {
+    size_t n = workers_.size();
+    for(size_t i = 1; i < n; i++) {
+        if(workers_[(self + i) % n]->local.TryPop(job)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::Run_(Worker& worker, Job& job) {
+    int64_t wait = NowMS_() - job.enqueueMS;
+    int64_t max = maxWaitMS_.load(std::memory_order_relaxed);
+    while(wait > max && !maxWaitMS_.compare_exchange_weak(max, wait, std::memory_order_relaxed)) {}
+    job.task();
+    job.task = nullptr;
+    worker.executed.store(worker.executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void ThreadPool::WorkerLoop_(size_t self) {
+    Worker& worker = *workers_[self];
+    bool elastic = maxThreads_ > minThreads_;
+    Job job;
+    while(true) {
+        if(Pop_(self, job)) {
+            Run_(worker, job);
+            continue;
+        }
+        // 先自旋：刚提交的任务往往马上就到，省掉一次睡眠和唤醒
+        bool found = false;
+        searching_++;
+        for(int i = 0; i < SPIN_ROUNDS && !found; i++) {
+            std::this_thread::yield();
+            found = Pop_(self, job);
+        }
+        searching_--;
+        if(found) {
+            // 自旋的线程找到了任务，提交者不会叫醒别人，还有剩余任务时由它接力唤醒一个
+            if(sleepers_.load() > 0 && HasWork_()) { Wake_(1); }
+            Run_(worker, job);
+            continue;
+        }
+        std::unique_lock<std::mutex> locker(parkMtx_);
+        sleepers_++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool timeout = false;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(idleMS_);
+        while(!HasWork_() && !isClosed_ && !timeout) {
+            if(elastic) {
+                timeout = parkCond_.wait_until(locker, deadline) == std::cv_status::timeout;
+            } else {
+                parkCond_.wait(locker);
+            }
+        }
+        sleepers_--;
+        if(isClosed_ && !HasWork_()) {
+            break;  // 已关闭且任务都执行完了
+        }
+        // 空闲太久，多于最少线程数时退出；检查和减少线程数都在parkMtx_下，不会减到minThreads以下
+        if(timeout && !HasWork_() && threadCount_.load() > minThreads_) {
+            int threads = --threadCount_;
+            shrunk_++;
+            worker.running = false;
+            locker.unlock();
+            LOG_INFO("ThreadPool shrink to %d threads", threads);
+            break;
+        }
+    }
+}
+
+void ThreadPool::Start_(size_t slot) {
+    Worker& worker = *workers_[slot];
+    if(worker.thread.joinable()) {
+        worker.thread.join();   // 之前在这个槽位上退出的线程
+    }
+    worker.running = true;
+    threadCount_++;
+    worker.thread = std::thread(&ThreadPool::WorkerLoop_, this, slot);
+}
+
+bool ThreadPool::Grow_() {
+    if(threadCount_.load() >= maxThreads_) { return false; }
+    for(size_t i = 0; i < workers_.size(); i++) {
+        if(!workers_[i]->running.load()) {
+            Start_(i);
+            grown_++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 每growWaitMS检查一次：任务排队太久，或者任务排了一个周期却一个都没执行完，就加一个线程
+void ThreadPool::Monitor_() {
+    uint64_t lastExecuted = 0;
+    bool hadWork = false;
+    std::unique_lock<std::mutex> locker(monitorMtx_);
+    while(!isClosed_) {
+        monitorCond_.wait_for(locker, std::chrono::milliseconds(growWaitMS_));
+        if(isClosed_) { break; }
+        int64_t wait = maxWaitMS_.exchange(0);
+        lastMaxWaitMS_ = wait;
+        uint64_t executed = 0;
+        for(const auto& worker : workers_) {
+            executed += worker->executed.load(std::memory_order_relaxed);
+        }
+        // 上次检查时已经有任务排着，这一整个周期一个任务都没执行完
+        bool hasWork = HasWork_();
+        bool stalled = hadWork && hasWork && executed == lastExecuted;
+        hadWork = hasWork;
+        lastExecuted = executed;
+        if((wait >= growWaitMS_ || stalled) && Grow_()) {
+            LOG_INFO("ThreadPool grow to %d threads, queue wait %lldms%s", threadCount_.load(),
+                     static_cast<long long>(wait), stalled ? ", workers blocked" : "");
+        }
+    }
+}
+
+ThreadPool::Stats ThreadPool::GetStats() const {
+    Stats stats;
+    stats.threads = threadCount_.load();
+    stats.minThreads = minThreads_;
+    stats.maxThreads = maxThreads_;
+    stats.idle = sleepers_.load();
+    stats.queued = Queued_();
+    stats.executed = 0;
+    for(const auto& worker : workers_) {
+        stats.executed += worker->executed.load(std::memory_order_relaxed);
+    }
+    stats.maxWaitMS = maxThreads_ > minThreads_ ? lastMaxWaitMS_.load() : maxWaitMS_.load();
+    stats.grown = grown_.load();
+    stats.shrunk = shrunk_.load();
+    stats.rejected = rejected_.load();
+    return stats;
+}
@@ -1,70 +1,155 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
 #include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <time.h>
+#include <stdint.h>
 #include <assert.h>
 
+#include "workqueue.h"
+#include "task.h"
+#include "../log/log.h"
 
+/*
+工作窃取线程池
+提交的任务先进全局注入队列（无锁），工作线程按 本地队列 -> 注入队列 -> 窃取其他线程的本地队列 的顺序取任务
+从注入队列取任务时一次多取几个放进自己的本地队列，空闲的线程可以从那里偷走
+找不到任务的线程先自旋一会儿再睡眠；有线程在自旋找任务时，提交任务不唤醒睡眠的线程
+Reactor一轮epoll_wait的事件可以用AddTasks一起提交：按线程分批放进本地队列，每批一次CAS，一次加锁唤醒所需的线程
+任务是内联存储的Task，队列槽位预先分配，提交和执行任务都不调用malloc
+
+线程数在[minThreads, maxThreads]之间伸缩：
+任务入队时记下时间，工作线程取出时算出排队时长；监控线程每growWaitMS检查一次，
+这段时间里有任务排队超过growWaitMS，或者有任务排着而一个都没执行完（线程都阻塞在数据库之类的调用上），就加一个线程
+睡眠超过idleMS的线程在多于minThreads时退出
+*/
 class ThreadPool {
 public:
-    ThreadPool() = default;
-    ThreadPool(ThreadPool&&) = default;
-    // explicit 关键字声明类的构造函数是显式调用的，而非隐式调用
-    explicit ThreadPool(int threadCount = 8) : pool_(std::make_shared<Pool>()) { 
-        assert(threadCount > 0);
-        for(int i = 0; i < threadCount; i++) {
-            // 创建一个新的线程，并立即将其分离，意味着主线程不需要等待这个新线程结束
-            // 新线程运行的是一个匿名函数（lambda表达式），通过捕获this指针来访问ThreadPool类的成员
-            std::thread([this]() {
-                std::unique_lock<std::mutex> locker(pool_->mtx_);
-                while(true) {
-                    // 如果任务队列不为空
-                    if(!pool_->tasks.empty()) {
-                        // 取出一个任务
-                        auto task = std::move(pool_->tasks.front());    // 左值变右值,资产转移
-                        pool_->tasks.pop();
-                        locker.unlock(); //取出任务，提前解锁
-                        task(); // 执行任务。此时可以解锁，允许其他线程访问任务队列
-                        locker.lock(); //执行完任务，再次锁定
-                    } else if(pool_->isClosed) {// 如果线程池被关闭
-                        break;
-                    } else {// 如果任务队列为空，线程池也没有被关闭
-                        pool_->cond_.wait(locker);    //等待时会自动解锁互斥锁，允许其他线程访问任务队列。当有新的任务被添加到队列时，线程会被唤醒，并自动重新锁定互斥锁。
-                    }
-                    
-                }
-            }).detach();    //调用后和主线程分离，子线程结束时自己立即回收资源
-        }
-    }
+    struct Stats {
+        int threads;            // 当前线程数
+        int minThreads;
+        int maxThreads;
+        int idle;               // 睡眠中的线程数
+        size_t queued;          // 排队的任务数（近似值）
+        int64_t maxWaitMS;      // 上一个检查周期里任务排队的最长时间，固定线程数时为启动以来的最长时间
+        uint64_t executed;      // 执行过的任务数
+        uint64_t rejected;      // 超过排队上限被拒绝的任务数
+        uint64_t grown;         // 扩容次数
+        uint64_t shrunk;        // 缩容次数
+    };
 
-    ~ThreadPool() {
-        if(pool_) {
-            std::unique_lock<std::mutex> locker(pool_->mtx_);
-            pool_->isClosed = true;
-        }
-        pool_->cond_.notify_all();  // 唤醒所有的线程
-    }
+    explicit ThreadPool(int threadCount = 8);   // 固定线程数
+    ThreadPool(int minThreads, int maxThreads, int growWaitMS = 10, int idleMS = 30000);
+    ~ThreadPool();  // 执行完已提交的任务再退出
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
 
     template<typename T>
     void AddTask(T&& task) {
-        std::unique_lock<std::mutex> locker(pool_->mtx_);
-        pool_->tasks.emplace(std::forward<T>(task));
-        pool_->cond_.notify_one();
+        Task t(std::forward<T>(task));
+        Push_(t);
     }
 
+    // 排队的任务达到上限时不提交，返回false，由调用者决定怎么回应（如返回503）；上限为0时不限制
+    template<typename T>
+    bool TryAddTask(T&& task) {
+        size_t limit = queueLimit_.load(std::memory_order_relaxed);
+        if(limit > 0 && Queued_() >= limit) {
+            rejected_++;
+            return false;
+        }
+        AddTask(std::forward<T>(task));
+        return true;
+    }
+
+    // 只限制TryAddTask，AddTask和AddTasks总是提交
+    void SetQueueLimit(size_t limit) { queueLimit_ = limit; }
+
+    // 批量提交：把n个任务分成min(n, 线程数)批，每批一次放进一个线程的本地队列，只唤醒需要的线程数
+    // 任务被移走，调用者可以复用数组
+    void AddTasks(Task* tasks, size_t n);
+
+    Stats GetStats() const;
+
 private:
-    // 用一个结构体封装起来，方便调用
-    struct Pool {
-        std::mutex mtx_;    // 互斥锁
-        std::condition_variable cond_;  //条件变量
-        bool isClosed;  //是否关闭
-        std::queue<std::function<void()>> tasks; // 任务队列，函数类型为void()
+    // 队列里存的是任务和入队时间
+    struct Job {
+        Job() : enqueueMS(0) {}
+        Job(Task&& t, int64_t ms) : task(std::move(t)), enqueueMS(ms) {}
+        Task task;
+        int64_t enqueueMS;
+    };
+
+    // 槽位按maxThreads预先建好，线程退出后槽位留着，扩容时复用
+    struct Worker {
+        explicit Worker(size_t capacity) : local(capacity), running(false), executed(0) {}
+        WorkQueue<Job> local;
+        std::thread thread;
+        std::atomic<bool> running;
+        alignas(64) std::atomic<uint64_t> executed;     // 只由本线程写，监控线程读
     };
-    std::shared_ptr<Pool> pool_;
+
+    static int64_t NowMS_() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+
+    void Push_(Task& task);
+    void Inject_(Job& job);                 // 放进注入队列，满了放进后备队列
+    void WorkerLoop_(size_t self);
+    void Monitor_();
+    void Start_(size_t slot);
+    bool Grow_();
+    bool Pop_(size_t self, Job& job);       // 按顺序找一个任务
+    bool Steal_(size_t self, Job& job);
+    void Run_(Worker& worker, Job& job);
+    size_t NextWorker_();
+    bool HasWork_() const;
+    size_t Queued_() const;                 // 各队列长度之和，近似值
+    void Wake_(int n);
+
+    static const size_t GLOBAL_CAPACITY = 16384;
+    static const size_t LOCAL_CAPACITY = 256;
+    static const int BATCH = 8;             // 从注入队列一次最多取的任务数
+    static const int SPIN_ROUNDS = 64;      // 睡眠前找任务的轮数
+
+    const int minThreads_;
+    const int maxThreads_;
+    const int growWaitMS_;
+    const int idleMS_;
+
+    WorkQueue<Job> global_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> nextWorker_;        // 批量提交轮流放进各线程的本地队列
+    std::atomic<int> threadCount_;
+
+    std::mutex overflowMtx_;
+    std::deque<Job> overflow_;              // 注入队列满时的后备，正常情况下为空
+    std::atomic<size_t> overflowSize_;
+
+    std::atomic<int> searching_;            // 正在自旋找任务的线程数
+    std::atomic<int> sleepers_;             // 睡眠中的线程数
+    std::mutex parkMtx_;
+    std::condition_variable parkCond_;
+    std::atomic<bool> isClosed_;
+
+    std::atomic<int64_t> maxWaitMS_;        // 本周期任务排队的最长时间，工作线程写入
+    std::atomic<int64_t> lastMaxWaitMS_;
+    std::atomic<uint64_t> grown_;
+    std::atomic<uint64_t> shrunk_;
+    std::atomic<size_t> queueLimit_;
+    std::atomic<uint64_t> rejected_;
+    std::thread monitor_;                   // 固定线程数时不启动
+    std::mutex monitorMtx_;
+    std::condition_variable monitorCond_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,134 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <atomic>
+#include <new>          // placement new
+#include <utility>
+#include <stddef.h>
+#include <assert.h>
+
+/*
+有界无锁多生产者多消费者队列（Dmitry Vyukov的算法），线程池的全局注入队列和每个工作线程的本地队列都用它
+槽位在构造时一次性分配，之后入队出队不分配内存
+每个槽有一个序号：序号等于入队位置时可以写，等于位置+1时可以读，读完后加上容量留给下一圈
+槽在写入到读出之间只属于一个线程，所以元素可以是任意可移动的类型，不要求能被并发读
+*/
+template<typename T>
+class WorkQueue {
+public:
+    explicit WorkQueue(size_t capacity) : mask_(RoundUp_(capacity) - 1), cells_(new Cell[mask_ + 1]) {
+        for(size_t i = 0; i <= mask_; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    ~WorkQueue() {
+        T item;
+        while(TryPop(item)) {}
+        delete[] cells_;
+    }
+
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    // 队列满时返回false，item保持不变
+    bool TryPush(T& item) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(diff == 0) {
+                if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            } else if(diff < 0) {
+                return false;   // 这个槽还没被读走，队列满
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        new (cell->storage) T(std::move(item));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 一次CAS占下连续的n个空槽，返回实际放进去的个数（队列快满时可能少于n），放进去的元素被移走
+    // 槽里的元素用T(std::move(items[i]), args...)构造，可以顺带附上同一批共用的数据
+    template<typename U, typename... Args>
+    size_t TryPushBatch(U* items, size_t n, const Args&... args) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        size_t cnt;
+        while(true) {
+            // 从pos开始数连续的空槽，中途遇到还没被读走的槽就只占前面这些
+            for(cnt = 0; cnt < n && cnt <= mask_; cnt++) {
+                size_t seq = cells_[(pos + cnt) & mask_].seq.load(std::memory_order_acquire);
+                if(seq != pos + cnt) { break; }
+            }
+            if(cnt == 0) {
+                size_t seq = cells_[pos & mask_].seq.load(std::memory_order_acquire);
+                if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos) < 0) { return 0; }  // 队列满
+                pos = tail_.load(std::memory_order_relaxed);    // 别的生产者先占了
+                continue;
+            }
+            if(tail_.compare_exchange_weak(pos, pos + cnt, std::memory_order_relaxed)) { break; }
+        }
+        for(size_t i = 0; i < cnt; i++) {
+            Cell& cell = cells_[(pos + i) & mask_];
+            new (cell.storage) T(std::move(items[i]), args...);
+            cell.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return cnt;
+    }
+
+    bool TryPop(T& item) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if(diff == 0) {
+                if(head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            } else if(diff < 0) {
+                return false;   // 队列空
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        T* p = reinterpret_cast<T*>(cell->storage);
+        item = std::move(*p);
+        p->~T();
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 近似值，只用于判断要不要唤醒线程、统计
+    size_t Size() const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+    bool Empty() const { return Size() == 0; }
+    size_t Capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    static size_t RoundUp_(size_t n) {
+        size_t cap = 2;
+        while(cap < n) { cap <<= 1; }
+        return cap;
+    }
+
+    const size_t mask_;
+    Cell* const cells_;
+    alignas(64) std::atomic<size_t> head_;  // 生产者和消费者的位置放在不同缓存行
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+#endif //WORK_QUEUE_H
@@ -0,0 +1,44 @@
+#include "conntable.h"
+
+ConnTable::ConnTable(int maxFd) : maxFd_(maxFd) {
+    assert(maxFd > 0);
+    // 匿名映射按页对齐且内容全为0（即gen为0、constructed为false），没被访问的页不占物理内存
+    void* mem = mmap(nullptr, sizeof(Slot) * maxFd_, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(mem != MAP_FAILED);
+    slots_ = static_cast<Slot*>(mem);
+}
+
+ConnTable::~ConnTable() {
+    for(int i = 0; i < maxFd_; i++) {
+        if(slots_[i].constructed.load(std::memory_order_relaxed)) {
+            reinterpret_cast<HttpConn*>(slots_[i].conn)->~HttpConn();
+        }
+    }
+    munmap(slots_, sizeof(Slot) * maxFd_);
+}
+
+uint32_t ConnTable::Acquire(int fd) {
+    assert(fd >= 0 && fd < maxFd_);
+    Get(fd);
+    slots_[fd].busy.store(false, std::memory_order_relaxed);
+    return slots_[fd].gen.fetch_add(1, std::memory_order_acq_rel) + 1;
+}
+
+void ConnTable::Release(int fd) {
+    assert(fd >= 0 && fd < maxFd_);
+    slots_[fd].busy.store(false, std::memory_order_relaxed);
+    slots_[fd].gen.fetch_add(1, std::memory_order_acq_rel);
+}
+
+// 返回fd对应的连接对象，首次访问时构造
+// 同一时刻一个fd只属于一个Reactor，fd被别的Reactor复用时靠release/acquire看到之前的构造
+HttpConn* ConnTable::Get(int fd) {
+    assert(fd >= 0 && fd < maxFd_);
+    Slot& slot = slots_[fd];
+    if(!slot.constructed.load(std::memory_order_acquire)) {
+        new (slot.conn) HttpConn();
+        slot.constructed.store(true, std::memory_order_release);
+    }
+    return reinterpret_cast<HttpConn*>(slot.conn);
+}
@@ -0,0 +1,62 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <sys/mman.h>   // mmap
+#include <stdint.h>
+#include <new>          // placement new
+#include <atomic>
+#include <assert.h>
+
+#include "../http/httpconn.h"
+
+/*
+以fd为下标的连接表，替代unordered_map<int, HttpConn>
+槽位数组按最大fd一次性分配、按缓存行对齐，不会因为扩容而使工作线程手里的HttpConn*失效
+HttpConn在第一次用到某个fd时才构造，没用到的槽位只占虚拟内存
+每个槽位带一个代数，占用和释放时各加一，定时器回调和线程池任务可以据此发现连接已经关闭或fd已经换了主人
+槽位还记着连接是否交给了线程池或数据库通道：交出去期间只有拿着它的任务能关闭它，到期的定时器要等它交还
+*/
+class ConnTable {
+public:
+    explicit ConnTable(int maxFd);
+    ~ConnTable();
+
+    ConnTable(const ConnTable&) = delete;
+    ConnTable& operator=(const ConnTable&) = delete;
+
+    // 新连接占用fd，返回新的代数
+    uint32_t Acquire(int fd);
+    // 连接关闭，在close(fd)之前调用，之后拿着旧代数的回调和任务都不再处理它
+    void Release(int fd);
+    HttpConn* Get(int fd);
+
+    uint32_t Gen(int fd) const {
+        assert(fd >= 0 && fd < maxFd_);
+        return slots_[fd].gen.load(std::memory_order_acquire);
+    }
+    bool IsCurrent(int fd, uint32_t gen) const { return Gen(fd) == gen; }
+
+    // 事件循环线程把连接交给任务前置位，任务交还（重新监听）前清除；释放连接时也清除
+    void SetBusy(int fd, bool busy) {
+        assert(fd >= 0 && fd < maxFd_);
+        slots_[fd].busy.store(busy, std::memory_order_release);
+    }
+    bool IsBusy(int fd) const {
+        assert(fd >= 0 && fd < maxFd_);
+        return slots_[fd].busy.load(std::memory_order_acquire);
+    }
+    int MaxFd() const { return maxFd_; }
+
+private:
+    struct alignas(64) Slot {
+        alignas(HttpConn) unsigned char conn[sizeof(HttpConn)];
+        std::atomic<uint32_t> gen;
+        std::atomic<bool> constructed;
+        std::atomic<bool> busy;
+    };
+
+    int maxFd_;
+    Slot* slots_;
+};
+
+#endif //CONN_TABLE_H
@@ -1,7 +1,11 @@
 #include "epoller.h"
 
-Epoller::Epoller(int maxEvent):epollFd_(epoll_create(512)), events_(maxEvent){
+Epoller::Epoller(int maxEvent, bool useIoUring):epollFd_(epoll_create(512)), events_(maxEvent){
     assert(epollFd_ >= 0 && events_.size() > 0);
+    if(useIoUring) {
+        uring_.reset(new UringPoller(maxEvent));
+        if(!uring_->IsOpen()) { uring_.reset(); }   // 内核不支持io_uring
+    }
 }
 
 Epoller::~Epoller() {
@@ -10,6 +14,7 @@ Epoller::~Epoller() {
 
 bool Epoller::AddFd(int fd, uint32_t events) {
     if(fd < 0) return false;
+    if(uring_) return uring_->AddFd(fd, events);
     epoll_event ev = {0};
     ev.data.fd = fd;
     ev.events = events;
@@ -18,6 +23,7 @@ bool Epoller::AddFd(int fd, uint32_t events) {
 
 bool Epoller::ModFd(int fd, uint32_t events) {
     if(fd < 0) return false;
+    if(uring_) return uring_->ModFd(fd, events);
     epoll_event ev = {0};
     ev.data.fd = fd;
     ev.events = events;
@@ -26,11 +32,13 @@ bool Epoller::ModFd(int fd, uint32_t events) {
 
 bool Epoller::DelFd(int fd) {
     if(fd < 0) return false;
+    if(uring_) return uring_->DelFd(fd);
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, 0);
 }
 
 // 返回事件数量
 int Epoller::Wait(int timeoutMs) {
+    if(uring_) return uring_->Wait(events_, timeoutMs);
     return epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs);
 }
 
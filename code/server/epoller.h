@@ -5,11 +5,15 @@
 #include <unistd.h> // close()
 #include <assert.h> // close()
 #include <vector>
+#include <memory>
 #include <errno.h>
 
+#include "uringpoller.h"
+
 class Epoller {
 public:
-    explicit Epoller(int maxEvent = 1024);
+    // useIoUring为true时优先使用io_uring后端，内核不支持则退回epoll
+    explicit Epoller(int maxEvent = 1024, bool useIoUring = false);
     ~Epoller();
 
     bool AddFd(int fd, uint32_t events);
@@ -18,10 +22,12 @@ public:
     int Wait(int timeoutMs = -1);
     int GetEventFd(size_t i) const;
     uint32_t GetEvents(size_t i) const;
+    bool IsIoUring() const { return uring_ != nullptr; }
         
 private:
     int epollFd_;
     std::vector<struct epoll_event> events_;    
+    std::unique_ptr<UringPoller> uring_;    // 为空时使用epoll
 };
 
 #endif //EPOLLER_H
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "uringpoller.h"
+
+UringPoller::UringPoller(unsigned entries)
+    : ringFd_(-1), wakeFd_(-1), sqEntries_(0), sqRing_(MAP_FAILED), cqRing_(MAP_FAILED), sqRingSz_(0), cqRingSz_(0),
+      sqes_(nullptr), sqesSz_(0), sqeTail_(0), waiting_(false), wakePending_(false) {
+    if(!Setup_(entries)) {
+        Release_();
+    }
+}
+
+UringPoller::~UringPoller() {
+    Release_();
+}
+
+// 创建io_uring并映射提交队列/完成队列
+bool UringPoller::Setup_(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;    // 每个fd最多一个poll在飞，完成队列留足余量
+    ringFd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if(ringFd_ < 0) { return false; }
+    // Wait依赖带超时的io_uring_enter
+    if(!(params.features & IORING_FEAT_EXT_ARG)) { return false; }
+
+    sqEntries_ = params.sq_entries;
+    sqRingSz_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSz_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) {
+        sqRingSz_ = cqRingSz_ = std::max(sqRingSz_, cqRingSz_);
+    }
+    sqRing_ = mmap(nullptr, sqRingSz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED) { return false; }
+    if(single) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+        if(cqRing_ == MAP_FAILED) { return false; }
+    }
+    sqesSz_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) { return false; }
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    sqeTail_ = *sqTail_;
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ < 0) { return false; }
+    PrepWake_();
+    return true;
+}
+
+void UringPoller::Release_() {
+    if(sqes_) { munmap(sqes_, sqesSz_); sqes_ = nullptr; }
+    if(cqRing_ != MAP_FAILED && cqRing_ != sqRing_) { munmap(cqRing_, cqRingSz_); }
+    if(sqRing_ != MAP_FAILED) { munmap(sqRing_, sqRingSz_); }
+    sqRing_ = cqRing_ = MAP_FAILED;
+    if(ringFd_ >= 0) { close(ringFd_); ringFd_ = -1; }
+    if(wakeFd_ >= 0) { close(wakeFd_); wakeFd_ = -1; }
+}
+
+int UringPoller::Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, const struct timespec* ts) {
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(ts);
+    return syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete,
+                   flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+// 发布填好的sqe，返回环上还没被内核取走的数量，调用者需持有mtx_
+// 待提交数按环上的头尾计算：Wait在锁外的提交失败、只提交了一部分或者还没进入内核时，剩下的sqe仍然算在里面
+unsigned UringPoller::PublishLocked_() {
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+    return sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+}
+
+// 把已填好的sqe交给内核，调用者需持有mtx_
+// 内核按顺序取sqe，并发的io_uring_enter在内核里串行：返回时这之前发布的sqe都已被取走，不管是谁提交的
+void UringPoller::FlushLocked_() {
+    unsigned pending = PublishLocked_();
+    while(pending > 0 && Enter_(pending, 0, 0, nullptr) > 0) {
+        pending = sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    }
+}
+
+// 取一个空闲的sqe，队列满了就先提交，调用者需持有mtx_
+// 取到的sqe先不发布，Wait在锁外提交时内核不会读到填了一半的sqe
+struct io_uring_sqe* UringPoller::GetSqe_() {
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    while(sqeTail_ - head >= sqEntries_) {
+        FlushLocked_();
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    }
+    unsigned idx = sqeTail_ & *sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[idx] = idx;
+    sqeTail_++;
+    return sqe;
+}
+
+UringPoller::FdState& UringPoller::State_(int fd) {
+    assert(fd >= 0);
+    if(static_cast<size_t>(fd) >= fds_.size()) {
+        fds_.resize(fd + 1024);
+    }
+    return fds_[fd];
+}
+
+// user_data高32位为注册代数，低32位为fd
+void UringPoller::PrepPoll_(int fd) {
+    FdState& st = State_(fd);
+    st.gen = (st.gen + 1) & GEN_MASK;
+    st.armed = true;
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = st.events & (EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP);
+    sqe->user_data = (static_cast<uint64_t>(st.gen) << 32) | static_cast<uint32_t>(fd);
+}
+
+void UringPoller::PrepRemove_(int fd) {
+    FdState& st = State_(fd);
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (static_cast<uint64_t>(st.gen) << 32) | static_cast<uint32_t>(fd);
+    sqe->user_data = REMOVE_TAG;
+    st.armed = false;
+}
+
+// 监听wakeFd_，随下一次提交一起交给内核
+void UringPoller::PrepWake_() {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakeFd_;
+    sqe->poll32_events = EPOLLIN;
+    sqe->user_data = WAKE_TAG;
+}
+
+// 其他线程填了sqe：事件循环在等待时叫醒它来提交，一次等待最多唤醒一次，调用者需持有mtx_
+void UringPoller::WakeLocked_() {
+    if(!waiting_ || wakePending_) { return; }
+    wakePending_ = true;
+    eventfd_write(wakeFd_, 1);
+}
+
+bool UringPoller::AddFd(int fd, uint32_t events) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    FdState& st = State_(fd);
+    if(st.armed) { PrepRemove_(fd); }
+    st.events = events;
+    PrepPoll_(fd);
+    WakeLocked_();
+    return true;
+}
+
+bool UringPoller::ModFd(int fd, uint32_t events) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    FdState& st = State_(fd);
+    if(st.events == 0) { return false; }    // 和epoll一样，未注册的fd不能修改
+    if(st.armed) { PrepRemove_(fd); }
+    st.events = events;
+    PrepPoll_(fd);
+    WakeLocked_();  // 不在这里提交，工作线程的重新注册由事件循环合并提交
+    return true;
+}
+
+bool UringPoller::DelFd(int fd) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    FdState& st = State_(fd);
+    if(st.events == 0) { return false; }
+    if(st.armed) { PrepRemove_(fd); }
+    st.events = 0;
+    // fd马上会被close，撤销必须先于close到达内核
+    FlushLocked_();
+    return true;
+}
+
+// 提交积攒的注册并等待完成事件，结果按epoll_event的格式写入events
+int UringPoller::Wait(std::vector<struct epoll_event>& events, int timeoutMs) {
+    unsigned toSubmit;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        toSubmit = PublishLocked_();    // 锁外提交时DelFd可能已经替它提交了一部分，内核最多取到环上实际有的
+        waiting_ = timeoutMs != 0;
+    }
+    struct timespec ts;
+    struct timespec* pts = nullptr;
+    if(timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        pts = &ts;
+    }
+    unsigned head = *cqHead_;
+    bool ready = head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    int ret = Enter_(toSubmit, (ready || timeoutMs == 0) ? 0 : 1, IORING_ENTER_GETEVENTS, pts);
+    if(ret < 0 && errno != ETIME && errno != EINTR) {
+        std::lock_guard<std::mutex> locker(mtx_);
+        waiting_ = false;
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    waiting_ = false;
+    int cnt = 0;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    while(head != tail && static_cast<size_t>(cnt) < events.size()) {
+        struct io_uring_cqe* cqe = &cqes_[head & *cqMask_];
+        head++;
+        if(cqe->user_data == REMOVE_TAG) { continue; }
+        if(cqe->user_data == WAKE_TAG) {
+            // 唤醒只是为了让事件循环回来提交，清空计数后重新监听
+            eventfd_t val;
+            eventfd_read(wakeFd_, &val);
+            wakePending_ = false;
+            PrepWake_();
+            continue;
+        }
+        int fd = static_cast<int>(cqe->user_data & 0xffffffff);
+        uint32_t gen = static_cast<uint32_t>(cqe->user_data >> 32);
+        FdState& st = State_(fd);
+        // 已被撤销或已被重新注册的poll
+        if(st.gen != gen || st.events == 0 || cqe->res == -ECANCELED) { continue; }
+        st.armed = false;
+        events[cnt].data.fd = fd;
+        events[cnt].events = cqe->res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe->res);
+        cnt++;
+        if(!(st.events & EPOLLONESHOT)) {
+            PrepPoll_(fd);  // 非ONESHOT的fd继续监听，随下一次Wait一起提交
+        }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return cnt;
+}
@@ -0,0 +1,91 @@
+#ifndef URING_POLLER_H
+#define URING_POLLER_H
+
+#include <sys/epoll.h>
+#include <sys/mman.h>       // mmap
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/*
+基于io_uring的就绪事件后端，对外和Epoller保持同样的语义（AddFd/ModFd/DelFd/Wait）
+用IORING_OP_POLL_ADD代替epoll_ctl，注册变化先放进提交队列，在下一次Wait时和等待合成一次io_uring_enter
+EPOLLONESHOT的fd触发后不再监听，等ModFd重新注册；其他fd触发后自动重新注册（相当于LT）
+工作线程的AddFd/ModFd也只填sqe：事件循环没在等待时由下一次Wait一起提交；正在等待时写一次eventfd
+把它唤醒，在它返回前到达的注册都只花这一次唤醒。只有DelFd必须在close之前单独提交
+内核不支持io_uring（或缺少IORING_FEAT_EXT_ARG）时IsOpen()返回false，由Epoller退回epoll
+*/
+class UringPoller {
+public:
+    explicit UringPoller(unsigned entries = 1024);
+    ~UringPoller();
+
+    bool IsOpen() const { return ringFd_ >= 0; }
+
+    bool AddFd(int fd, uint32_t events);
+    bool ModFd(int fd, uint32_t events);
+    bool DelFd(int fd);
+    int Wait(std::vector<struct epoll_event>& events, int timeoutMs);
+
+private:
+    struct FdState {
+        uint32_t events = 0;    // 注册的事件，0表示未注册
+        uint32_t gen = 0;       // 每次注册递增（只用低30位），用来丢弃已撤销的poll的完成事件
+        bool armed = false;     // 内核中是否有未完成的poll
+    };
+
+    bool Setup_(unsigned entries);
+    void Release_();
+    struct io_uring_sqe* GetSqe_();
+    void PrepPoll_(int fd);
+    void PrepRemove_(int fd);
+    void PrepWake_();
+    void WakeLocked_();
+    int Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, const struct timespec* ts);
+    unsigned PublishLocked_();
+    void FlushLocked_();
+    FdState& State_(int fd);
+
+    // poll的user_data高32位为注册代数，代数只用低30位，不会和下面两个标记相同
+    static const uint32_t GEN_MASK = (1U << 30) - 1;
+    static const uint64_t REMOVE_TAG = 1ULL << 63;  // POLL_REMOVE自身的完成事件，直接忽略
+    static const uint64_t WAKE_TAG = 1ULL << 62;    // wakeFd_的poll，不交给调用者
+
+    int ringFd_;
+    int wakeFd_;                        // eventfd，其他线程有新的注册时唤醒阻塞在Wait里的事件循环
+    unsigned sqEntries_;
+
+    void* sqRing_;
+    void* cqRing_;
+    size_t sqRingSz_;
+    size_t cqRingSz_;
+    struct io_uring_sqe* sqes_;
+    size_t sqesSz_;
+
+    // 共享环上的指针
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqArray_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+    struct io_uring_cqe* cqes_;
+
+    unsigned sqeTail_;                  // 本地的提交队列尾：sqe填好后才随PublishLocked_对内核可见
+    std::vector<FdState> fds_;          // 以fd为下标
+    bool waiting_;                      // 事件循环正阻塞在io_uring_enter里
+    bool wakePending_;                  // 已经写过wakeFd_，事件循环还没处理
+    std::mutex mtx_;
+};
+
+#endif //URING_POLLER_H
@@ -2,27 +2,30 @@
 
 using namespace std;
 
-WebServer::WebServer(
-            int port, int trigMode, int timeoutMS,
-            int sqlPort, const char* sqlUser, const  char* sqlPwd,
-            const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
-            port_(port), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+WebServer::WebServer(const Config& config):
+            port_(config.port), timeoutMS_(config.timeoutMS), isClose_(false), multiReactor_(config.reactorNum > 0),
+            ioUring_(config.ioUring), users_(new ConnTable(MAX_FD))
     {
 
     // 是否打开日志标志
-    if(openLog) {
-        Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
+    if(config.openLog) {
+        Log::Instance()->init(config.logLevel, "./log", ".log", config.logQueSize);
         if(isClose_) { LOG_ERROR("========== Server init error!=========="); }
         else {
             LOG_INFO("========== Server init ==========");
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
-            LOG_INFO("LogSys level: %d", logLevel);
+            LOG_INFO("LogSys level: %d", config.logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            if(multiReactor_) {
+                LOG_INFO("SqlConnPool num: %d, db lane queue: %d, Reactor num: %d", config.connPoolNum, config.dbQueueMax, config.reactorNum);
+            } else {
+                LOG_INFO("SqlConnPool num: %d, db lane queue: %d, ThreadPool num: %d-%d, inline: %dKB",
+                         config.connPoolNum, config.dbQueueMax, config.threadNum, config.threadMax, config.inlineKB);
+            }
+            LOG_INFO("Max body: %dKB, max upload: %dKB, spill to file above: %dKB, upload dir: %s",
+                     config.maxBodyKB, config.maxUploadKB, config.spillKB, config.uploadDir ? config.uploadDir : "(disabled)");
         }
     }
 
@@ -31,18 +34,74 @@ WebServer::WebServer(
     strcat(srcDir_, "/resources/");
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    HttpConn::idleTimeoutMS = config.timeoutMS;
+    HttpConn::headerTimeoutMS = config.headerTimeoutMS;
+    HttpConn::bodyTimeoutMS = config.bodyTimeoutMS;
+    HttpConn::minRate = config.minRate;
+    HttpConn::inlineMaxBytes = multiReactor_ ? 0 : static_cast<size_t>(config.inlineKB) << 10;   // 多Reactor模式本来就在事件循环线程处理
+    HttpRequest::maxBodyBytes = static_cast<size_t>(config.maxBodyKB) << 10;
+    HttpRequest::maxUploadBytes = static_cast<size_t>(config.maxUploadKB) << 10;   // 只用于上传页面，其他POST仍受maxBodyKB限制
+    HttpRequest::spillBytes = static_cast<size_t>(config.spillKB) << 10;   // 更大的消息体写临时文件，不占连接的缓冲区
+    HttpRequest::uploadDir = config.uploadDir;
+    if(config.uploadDir && mkdir(config.uploadDir, 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR("Create upload dir %s error: %s", config.uploadDir, strerror(errno));
+        HttpRequest::uploadDir = nullptr;
+    }
+    armMS_ = config.timeoutMS;
+    for(int t : { config.headerTimeoutMS, config.bodyTimeoutMS }) {
+        if(t > 0 && t < armMS_) { armMS_ = t; }
+    }
+    // 静态资源的打开文件缓存，条目数或容量为0时不缓存；超过sendfileKB的文件不映射，用sendfile发送
+    FileCache::Instance()->Init(srcDir_, config.cacheEntries, static_cast<size_t>(config.cacheMB) << 20,
+                                static_cast<size_t>(config.sendfileKB) << 10);
 
     // 初始化操作
-    SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);  // 连接池单例的初始化
+    SqlConnPool::Instance()->Init("localhost", config.sqlPort, config.sqlUser, config.sqlPwd, config.dbName, config.connPoolNum);  // 连接池单例的初始化
     // 初始化事件和初始化socket(监听)
-    InitEventMode_(trigMode);
-    if(!InitSocket_()) { isClose_ = true;}
+    InitEventMode_(config.trigMode);
+    // 单Reactor模式：一个事件循环 + 线程池；多Reactor模式：reactorNum个事件循环，各自监听同一端口
+    int loopNum = multiReactor_ ? config.reactorNum : 1;
+    if(!multiReactor_) {
+        threadpool_.reset(new ThreadPool(config.threadNum, config.threadMax));  // 任务排队变久或线程都阻塞时扩容，空闲时缩回threadNum
+    }
+    // 登录/注册会阻塞在数据库上，单独的通道执行，不占用快速通道的线程；多Reactor模式下也不阻塞事件循环
+    dbPool_.reset(new ThreadPool(config.connPoolNum));
+    dbPool_->SetQueueLimit(config.dbQueueMax);
+    for(int i = 0; i < loopNum; i++) {
+        reactors_.emplace_back(new Reactor());
+        Reactor* reactor = reactors_.back().get();
+        reactor->epoller.reset(new Epoller(1024, ioUring_));
+        reactor->timer.reset(new TimingWheel());
+        if(!multiReactor_) { reactor->pending.reserve(1024); }
+        if(ioUring_ && !reactor->epoller->IsIoUring()) {
+            LOG_WARN("io_uring unsupported, fall back to epoll");
+        }
+        if(!InitSocket_(reactor)) { isClose_ = true; break; }
+    }
+    if(!reactors_.empty()) {
+        LOG_INFO("Event backend: %s", reactors_[0]->epoller->IsIoUring() ? "io_uring" : "epoll");
+    }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
     isClose_ = true;
+    for(auto& reactor : reactors_) {
+        if(reactor->listenFd >= 0) { close(reactor->listenFd); }
+    }
+    // 先执行完两个通道里剩下的任务，它们还会用到连接表和事件循环
+    if(threadpool_) {
+        LogPoolStats_("fast", *threadpool_);
+        threadpool_.reset();
+    }
+    if(dbPool_) {
+        LogPoolStats_("db", *dbPool_);
+        dbPool_.reset();
+    }
+    BufferArena::Stats arena = BufferArena::GetStats();
+    LOG_INFO("buffer arena in use: %zuKB, high water: %zuKB, cached: %zuKB, allocs: %llu", arena.inUse >> 10,
+             arena.highWater >> 10, arena.cached >> 10, static_cast<unsigned long long>(arena.allocs));
     free(srcDir_);
+    FileCache::Instance()->Close();
     SqlConnPool::Instance()->ClosePool();
 }
 
@@ -72,35 +131,61 @@ void WebServer::InitEventMode_(int trigMode) {
 }
 
 void WebServer::Start() {
-    int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
     if(!isClose_) { LOG_INFO("========== Server start =========="); }
+    // 其余的事件循环各占一个线程，第一个在当前线程运行
+    for(size_t i = 1; i < reactors_.size() && !isClose_; i++) {
+        loopThreads_.emplace_back(&WebServer::Loop_, this, reactors_[i].get());
+    }
+    if(!reactors_.empty()) {
+        Loop_(reactors_[0].get());
+    }
+    for(auto& t : loopThreads_) {
+        t.join();
+    }
+    loopThreads_.clear();
+}
+
+void WebServer::Loop_(Reactor* reactor) {
+    int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
+    reactor->loopThread = std::this_thread::get_id();
+    LoopClock::Update();
     while(!isClose_) {
         if(timeoutMS_ > 0) {
-            timeMS = timer_->GetNextTick();     // 获取下一次的超时等待事件(至少这个时间才会有用户过期，每次关闭超时连接则需要有新的请求进来)
+            timeMS = reactor->timer->GetNextTick();     // 获取下一次的超时等待事件(至少这个时间才会有用户过期，每次关闭超时连接则需要有新的请求进来)
         }
-        int eventCnt = epoller_->Wait(timeMS);
+        if(timeMS < 0 || timeMS > LoopClock::MAX_STALE_MS) {
+            timeMS = LoopClock::MAX_STALE_MS;   // 空闲时也定期醒来采样，工作线程的日志和Date首部不会停在很久以前
+        }
+        int eventCnt = reactor->epoller->Wait(timeMS);
+        LoopClock::Update();    // 每轮只读一次时钟，这一轮的定时器刷新、日志和响应头都用它
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
-            int fd = epoller_->GetEventFd(i);
-            uint32_t events = epoller_->GetEvents(i);
-            if(fd == listenFd_) {
-                DealListen_();
+            int fd = reactor->epoller->GetEventFd(i);
+            uint32_t events = reactor->epoller->GetEvents(i);
+            if(fd == reactor->listenFd) {
+                DealListen_(reactor);
             }
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                assert(users_.count(fd) > 0);
-                CloseConn_(&users_[fd]);
+                CloseConn_(reactor, users_->Get(fd));
             }
             else if(events & EPOLLIN) {
-                assert(users_.count(fd) > 0);
-                DealRead_(&users_[fd]);
+                DealRead_(reactor, users_->Get(fd));
             }
             else if(events & EPOLLOUT) {
-                assert(users_.count(fd) > 0);
-                DealWrite_(&users_[fd]);
+                DealWrite_(reactor, users_->Get(fd));
             } else {
                 LOG_ERROR("Unexpected event");
             }
         }
+        FlushTasks_(reactor);
+    }
+}
+
+// 把这一轮收集的任务一次提交，线程池按线程分批，只加一次锁唤醒需要的线程
+void WebServer::FlushTasks_(Reactor* reactor) {
+    if(!reactor->pending.empty()) {
+        threadpool_->AddTasks(reactor->pending.data(), reactor->pending.size());
+        reactor->pending.clear();
     }
 }
 
@@ -113,117 +198,250 @@ void WebServer::SendError_(int fd, const char*info) {
     close(fd);
 }
 
-void WebServer::CloseConn_(HttpConn* client) {
-    assert(client);
+void WebServer::CloseConn_(Reactor* reactor, HttpConn* client) {
+    assert(reactor && client);
     LOG_INFO("Client[%d] quit!", client->GetFd());
-    epoller_->DelFd(client->GetFd());
+    // 在工作线程上关闭时不碰定时器，留下的定时器到期时代数已经不同，什么也不做；fd复用时add会覆盖它
+    if(std::this_thread::get_id() == reactor->loopThread) {
+        reactor->timer->del(client->GetFd());
+    }
+    reactor->epoller->DelFd(client->GetFd());
+    users_->Release(client->GetFd());   // 在close之前：关闭后fd可能马上被别的连接复用
     client->Close();
 }
 
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
-    assert(fd > 0);
-    users_[fd].init(fd, addr);
+// 定时器回调：fd已被关闭并复用时代数不同，不能误关新连接
+// 定时器按最早可能的截止时间触发，截止时间被顺延了就按剩下的时间重新计时
+// 连接还在线程池或数据库通道的任务手里时不能关闭（任务正在用它的缓冲区和文件），等任务交还后再判断
+void WebServer::CloseExpired_(Reactor* reactor, HttpConn* client, uint32_t gen) {
+    if(!users_->IsCurrent(client->GetFd(), gen)) { return; }
+    int64_t left = client->Deadline() - LoopClock::NowMs();
+    if(left <= 0 && users_->IsBusy(client->GetFd())) {
+        left = BUSY_RECHECK_MS;
+    }
+    if(left > 0) {
+        reactor->timer->add(client->GetFd(), static_cast<int>(min<int64_t>(left, INT32_MAX)),
+                            std::bind(&WebServer::CloseExpired_, this, reactor, client, gen));
+        return;
+    }
+    static const char* PHASE_NAME[] = { "idle", "header", "body", "write" };
+    LOG_INFO("Client[%d] %s timeout!", client->GetFd(), PHASE_NAME[client->Phase()]);
+    CloseConn_(reactor, client);
+}
+
+void WebServer::AddClient_(Reactor* reactor, int fd, sockaddr_in addr) {
+    assert(reactor && fd > 0);
+    uint32_t gen = users_->Acquire(fd);
+    HttpConn* client = users_->Get(fd);
+    client->init(fd, addr);
     if(timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        reactor->timer->add(fd, timeoutMS_, std::bind(&WebServer::CloseExpired_, this, reactor, client, gen));   // 空闲阶段
     }
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);
+    reactor->epoller->AddFd(fd, EPOLLIN | connEvent_);
     SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+    LOG_INFO("Client[%d] in!", client->GetFd());
 }
 
 // 处理监听套接字，主要逻辑是accept新的套接字，并加入timer和epoller中
-void WebServer::DealListen_() {
+void WebServer::DealListen_(Reactor* reactor) {
     struct sockaddr_in addr;
     socklen_t len = sizeof(addr);
     do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+        int fd = accept(reactor->listenFd, (struct sockaddr *)&addr, &len);
         if(fd <= 0) { return;}
-        else if(HttpConn::userCount >= MAX_FD) {
+        else if(fd >= MAX_FD || HttpConn::userCount >= MAX_FD) {
             SendError_(fd, "Server busy!");
             LOG_WARN("Clients is full!");
             return;
         }
-        AddClient_(fd, addr);
+        AddClient_(reactor, fd, addr);
     } while(listenEvent_ & EPOLLET);
 }
 
-// 处理读事件，主要逻辑是将OnRead加入线程池的任务队列中
-void WebServer::DealRead_(HttpConn* client) {
+// 处理读事件，主要逻辑是将OnRead加入这一轮的待提交任务中，多Reactor模式下直接在本线程处理
+// 单Reactor模式下开启了快速路径时先在本线程读取，缓存中的小文件直接响应；正在收消息体的连接不走快速路径，
+// 大的上传要写临时文件，不能让它占着事件循环线程
+void WebServer::DealRead_(Reactor* reactor, HttpConn* client) {
     assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client)); // 这是一个右值，bind将参数和函数绑定
+    ExtentTime_(reactor, client);
+    uint32_t gen = users_->Gen(client->GetFd());
+    if(multiReactor_) {
+        OnRead_(reactor, client, gen);
+        return;
+    }
+    if(HttpConn::inlineMaxBytes > 0 && client->Phase() != HttpConn::BODY) {
+        OnReadInline_(reactor, client);
+        return;
+    }
+    users_->SetBusy(client->GetFd(), true);
+    reactor->pending.emplace_back(std::bind(&WebServer::OnRead_, this, reactor, client, gen)); // bind将参数和函数绑定
 }
 
-// 处理写事件，主要逻辑是将OnWrite加入线程池的任务队列中
-void WebServer::DealWrite_(HttpConn* client) {
+// 处理写事件，主要逻辑是将OnWrite加入这一轮的待提交任务中，多Reactor模式下直接在本线程处理
+void WebServer::DealWrite_(Reactor* reactor, HttpConn* client) {
     assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    ExtentTime_(reactor, client);
+    uint32_t gen = users_->Gen(client->GetFd());
+    if(multiReactor_) {
+        OnWrite_(reactor, client, gen);
+        return;
+    }
+    users_->SetBusy(client->GetFd(), true);
+    reactor->pending.emplace_back(std::bind(&WebServer::OnWrite_, this, reactor, client, gen));
 }
 
-void WebServer::ExtentTime_(HttpConn* client) {
+void WebServer::ExtentTime_(Reactor* reactor, HttpConn* client) {
     assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    // 这次事件处理完后连接可能进入新的阶段（截止时间在armMS_之后），也可能还在原来的阶段，取较早的一个
+    if(timeoutMS_ > 0) {
+        int64_t left = max<int64_t>(0, min<int64_t>(client->Deadline() - LoopClock::NowMs(), armMS_));
+        reactor->timer->adjust(client->GetFd(), static_cast<int>(left));
+    }
 }
 
-void WebServer::OnRead_(HttpConn* client) {
+void WebServer::OnRead_(Reactor* reactor, HttpConn* client, uint32_t gen) {
     assert(client);
+    if(!users_->IsCurrent(client->GetFd(), gen)) { return; }   // 任务排队期间连接已被关闭并复用
     int ret = -1;
     int readErrno = 0;
     ret = client->read(&readErrno);         // 读取客户端套接字的数据，读到httpconn的读缓存区
     if(ret <= 0 && readErrno != EAGAIN) {   // 读异常就关闭客户端
-        CloseConn_(client);
+        CloseConn_(reactor, client);
         return;
     }
     // 业务逻辑的处理（先读后处理）
-    OnProcess(client);
+    OnProcess(reactor, client);
+}
+
+// 快速路径：读取和响应都在事件循环线程完成，省掉一次线程切换；
+// 遇到要读磁盘、压缩或查数据库的请求，交给线程池或数据库通道从这个请求接着处理
+void WebServer::OnReadInline_(Reactor* reactor, HttpConn* client) {
+    int readErrno = 0;
+    int ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        CloseConn_(reactor, client);
+        return;
+    }
+    uint32_t gen = users_->Gen(client->GetFd());
+    for(int round = 0; round < INLINE_ROUNDS; round++) {
+        if(!client->process(true)) {
+            if(client->NeedsDb()) {
+                DealDb_(reactor, client);
+            } else if(client->NeedsWorker()) {
+                users_->SetBusy(client->GetFd(), true);
+                reactor->pending.emplace_back(std::bind(&WebServer::OnDeferred_, this, reactor, client, gen));
+            } else {
+                reactor->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+            }
+            return;
+        }
+        int writeErrno = 0;
+        ret = client->write(&writeErrno);
+        if(client->ToWriteBytes() > 0) {
+            if(ret > 0 || writeErrno == EAGAIN) {
+                reactor->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);   // 发送缓冲区满了，剩下的交给OnWrite_
+            } else {
+                CloseConn_(reactor, client);
+            }
+            return;
+        }
+        if(!client->IsKeepAlive()) {
+            CloseConn_(reactor, client);
+            return;
+        }
+    }
+    users_->SetBusy(client->GetFd(), true);
+    reactor->pending.emplace_back(std::bind(&WebServer::OnDeferred_, this, reactor, client, gen));
+}
+
+void WebServer::OnDeferred_(Reactor* reactor, HttpConn* client, uint32_t gen) {
+    assert(client);
+    if(!users_->IsCurrent(client->GetFd(), gen)) { return; }
+    OnProcess(reactor, client);
 }
 
 /* 处理读（请求）数据的函数 */
-void WebServer::OnProcess(HttpConn* client) {
+void WebServer::OnProcess(Reactor* reactor, HttpConn* client) {
     // 首先调用process()进行逻辑处理
     if(client->process()) { // 根据返回的信息重新将fd置为EPOLLOUT（写）或EPOLLIN（读）
     //读完事件就跟内核说可以写了
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);    // 响应成功，修改监听事件为写,等待OnWrite_()发送
+        Rearm_(reactor, client, EPOLLOUT);    // 响应成功，修改监听事件为写,等待OnWrite_()发送
+    } else if(client->NeedsDb()) {
+        DealDb_(reactor, client);   // 不重新监听，数据库通道生成响应后再监听写事件
     } else {
     //写完事件就跟内核说可以读了
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        Rearm_(reactor, client, EPOLLIN);
     }
 }
 
-void WebServer::OnWrite_(HttpConn* client) {
+// 任务把连接交还给事件循环：先清除忙标记再重新监听，重新监听之后连接随时可能被事件循环交给下一个任务
+void WebServer::Rearm_(Reactor* reactor, HttpConn* client, uint32_t events) {
+    int fd = client->GetFd();
+    users_->SetBusy(fd, false);
+    reactor->epoller->ModFd(fd, connEvent_ | events);
+}
+
+// 要查数据库的请求放进数据库通道；通道排满时直接回503，不让登录请求堆积
+void WebServer::DealDb_(Reactor* reactor, HttpConn* client) {
+    uint32_t gen = users_->Gen(client->GetFd());
+    users_->SetBusy(client->GetFd(), true);     // 从事件循环线程的快速路径进来时还没置位
+    if(!dbPool_->TryAddTask(std::bind(&WebServer::OnVerify_, this, reactor, client, gen))) {
+        LOG_WARN("Client[%d] db lane full!", client->GetFd());
+        client->RejectDb();
+        OnProcess(reactor, client);
+    }
+}
+
+void WebServer::OnVerify_(Reactor* reactor, HttpConn* client, uint32_t gen) {
+    assert(client);
+    if(!users_->IsCurrent(client->GetFd(), gen)) { return; }
+    client->Verify();
+    OnProcess(reactor, client);
+}
+
+void WebServer::OnWrite_(Reactor* reactor, HttpConn* client, uint32_t gen) {
     assert(client);
+    if(!users_->IsCurrent(client->GetFd(), gen)) { return; }
     int ret = -1;
     int writeErrno = 0;
     ret = client->write(&writeErrno);
     if(client->ToWriteBytes() == 0) {
         /* 传输完成 */
         if(client->IsKeepAlive()) {
-            // OnProcess(client);
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN); // 回归换成监测读事件
+            // 读缓冲区里可能还有流水线上的请求，先处理它们；没有完整请求时process返回false，回归换成监测读事件
+            OnProcess(reactor, client);
             return;
         }
     }
     else if(ret < 0) {
         if(writeErrno == EAGAIN) {  // 缓冲区满了 
             /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+            Rearm_(reactor, client, EPOLLOUT);
             return;
         }
     }
-    CloseConn_(client);
+    CloseConn_(reactor, client);
+}
+
+void WebServer::LogPoolStats_(const char* name, const ThreadPool& pool) {
+    ThreadPool::Stats stats = pool.GetStats();
+    LOG_INFO("%s lane threads: %d (%d-%d), queued: %zu, max wait: %lldms, executed: %llu, rejected: %llu, "
+             "grown: %llu, shrunk: %llu", name, stats.threads, stats.minThreads, stats.maxThreads, stats.queued,
+             static_cast<long long>(stats.maxWaitMS), static_cast<unsigned long long>(stats.executed),
+             static_cast<unsigned long long>(stats.rejected), static_cast<unsigned long long>(stats.grown),
+             static_cast<unsigned long long>(stats.shrunk));
 }
 
 /* Create listenFd */
-bool WebServer::InitSocket_() {
+bool WebServer::InitSocket_(Reactor* reactor) {
     int ret;
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_port = htons(port_);
 
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0) {
         LOG_ERROR("Create socket error!", port_);
         return false;
     }
@@ -231,35 +449,45 @@ bool WebServer::InitSocket_() {
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
+    /* 多Reactor模式：每个事件循环一个监听套接字，由内核在它们之间分发新连接 */
+    if(multiReactor_) {
+        ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+        if(ret == -1) {
+            LOG_ERROR("set socket SO_REUSEPORT error !");
+            close(listenFd);
+            return false;
+        }
+    }
 
     // 绑定
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    ret = bind(listenFd, (struct sockaddr *)&addr, sizeof(addr));
     if(ret < 0) {
         LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
 
     // 监听
-    ret = listen(listenFd_, 8);
+    ret = listen(listenFd, 8);
     if(ret < 0) {
         LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);  // 将监听套接字加入epoller
+    ret = reactor->epoller->AddFd(listenFd,  listenEvent_ | EPOLLIN);  // 将监听套接字加入epoller
     if(ret == 0) {
         LOG_ERROR("Add listen error!");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
-    SetFdNonblock(listenFd_);   
+    SetFdNonblock(listenFd);   
+    reactor->listenFd = listenFd;
     LOG_INFO("Server port:%d", port_);
     return true;
 }
@@ -2,6 +2,8 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <vector>
+#include <thread>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
@@ -9,62 +11,131 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>    // mkdir
 
 #include "epoller.h"
-#include "../timer/heaptimer.h"
+#include "conntable.h"
+#include "../timer/timingwheel.h"
 
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 
 #include "../http/httpconn.h"
+#include "../http/filecache.h"
 
 class WebServer {
 public:
-    WebServer(
-        int port, int trigMode, int timeoutMS, 
-        int sqlPort, const char* sqlUser, const  char* sqlPwd, 
-        const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+    // 服务器配置：字段都有默认值，只需设置要改的，如
+    //   WebServer::Config config;
+    //   config.port = 8080;
+    //   WebServer server(config);
+    struct Config {
+        // 监听和事件循环
+        int port = 1316;
+        int trigMode = 3;           // 0: LT+LT 1: 连接ET 2: 监听ET 3: ET+ET
+        int reactorNum = 0;         // 事件循环数量，0为单Reactor+线程池
+        bool ioUring = false;       // 事件后端优先使用io_uring，不支持时退回epoll
+
+        // 连接各阶段的超时（毫秒），0表示不限制
+        int timeoutMS = 60000;      // keep-alive空闲超时，为0时不启用定时器
+        int headerTimeoutMS = 20000;
+        int bodyTimeoutMS = 20000;
+        int minRate = 500;          // 收发消息体的最低速率（字节/秒）
+
+        // 数据库和线程池
+        int sqlPort = 3306;
+        const char* sqlUser = "root";
+        const char* sqlPwd = "";
+        const char* dbName = "webserver";
+        int connPoolNum = 12;       // 数据库连接数，也是数据库通道的线程数
+        int dbQueueMax = 256;       // 数据库通道的排队上限，超过时回503
+        int threadNum = 4;          // 线程池最少线程数（单Reactor模式）
+        int threadMax = 32;         // 线程池最多线程数
+
+        // 日志
+        bool openLog = true;
+        int logLevel = 1;
+        int logQueSize = 1024;      // 异步日志队列容量，0为同步日志
+
+        // 静态文件
+        int cacheEntries = 1024;    // 打开文件缓存的条目数，和容量有一个为0时不缓存
+        int cacheMB = 64;
+        int sendfileKB = 256;       // 超过这个大小的文件不映射，用sendfile发送
+        int inlineKB = 0;           // 事件循环线程直接响应的缓存文件上限，0为关闭
+
+        // 请求体和上传
+        int maxBodyKB = 65536;      // 请求体上限
+        int maxUploadKB = 1048576;  // 上传页面的multipart请求体上限
+        int spillKB = 64;           // 请求体超过这个大小时写临时文件
+        const char* uploadDir = nullptr;    // 上传文件目录，nullptr为不接受上传
+    };
+
+    explicit WebServer(const Config& config);
 
     ~WebServer();
     void Start();
 
 private:
-    bool InitSocket_(); 
+    // 一个事件循环：独立的监听套接字、epoll和定时器，连接放在共享的users_中（fd在进程内唯一）
+    // 单Reactor模式下只有一个，读写交给线程池；多Reactor模式下每个线程一个，就地解析和响应
+    struct Reactor {
+        int listenFd = -1;
+        std::unique_ptr<Epoller> epoller;
+        std::unique_ptr<TimingWheel> timer;
+        std::vector<Task> pending;      // 单Reactor模式下这一轮事件产生的读写任务，轮末一起交给线程池
+        std::thread::id loopThread;     // 运行这个事件循环的线程，定时器只能在这个线程上操作
+    };
+
+    bool InitSocket_(Reactor* reactor); 
     void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
+    void AddClient_(Reactor* reactor, int fd, sockaddr_in addr);
+    void Loop_(Reactor* reactor);
   
-    void DealListen_();
-    void DealWrite_(HttpConn* client);
-    void DealRead_(HttpConn* client);
+    void DealListen_(Reactor* reactor);
+    void DealWrite_(Reactor* reactor, HttpConn* client);
+    void DealRead_(Reactor* reactor, HttpConn* client);
+    void FlushTasks_(Reactor* reactor);
 
     void SendError_(int fd, const char*info);
-    void ExtentTime_(HttpConn* client);
-    void CloseConn_(HttpConn* client);
+    void ExtentTime_(Reactor* reactor, HttpConn* client);
+    void CloseConn_(Reactor* reactor, HttpConn* client);
+    void CloseExpired_(Reactor* reactor, HttpConn* client, uint32_t gen);
+
+    void OnRead_(Reactor* reactor, HttpConn* client, uint32_t gen);
+    void OnReadInline_(Reactor* reactor, HttpConn* client);
+    void OnDeferred_(Reactor* reactor, HttpConn* client, uint32_t gen);
+    void OnWrite_(Reactor* reactor, HttpConn* client, uint32_t gen);
+    void OnProcess(Reactor* reactor, HttpConn* client);
+    void Rearm_(Reactor* reactor, HttpConn* client, uint32_t events);
+    void DealDb_(Reactor* reactor, HttpConn* client);
+    void OnVerify_(Reactor* reactor, HttpConn* client, uint32_t gen);
 
-    void OnRead_(HttpConn* client);
-    void OnWrite_(HttpConn* client);
-    void OnProcess(HttpConn* client);
+    static void LogPoolStats_(const char* name, const ThreadPool& pool);
 
     static const int MAX_FD = 65536;
+    static const int INLINE_ROUNDS = 4;     // 事件循环线程对一个连接最多连续处理的批数，剩下的流水线请求交给线程池
+    static const int BUSY_RECHECK_MS = 50;  // 连接到期时还在任务手里，隔这么久再看一次
 
     static int SetFdNonblock(int fd);
 
     int port_;
     bool openLinger_;
-    int timeoutMS_;  /* 毫秒MS */
-    bool isClose_;
-    int listenFd_;
+    int timeoutMS_;  /* 毫秒MS，keep-alive空闲超时，为0时不启用定时器 */
+    int armMS_;      /* 各阶段超时中最短的一个，事件到来后定时器最晚在这之后检查一次 */
+    std::atomic<bool> isClose_;
+    bool multiReactor_;     // 多Reactor模式：每个线程一个事件循环，SO_REUSEPORT分摊连接
+    bool ioUring_;          // 事件后端优先使用io_uring
     char* srcDir_;
     
     uint32_t listenEvent_;  // 监听事件
     uint32_t connEvent_;    // 连接事件
    
-    std::unique_ptr<HeapTimer> timer_;
-    std::unique_ptr<ThreadPool> threadpool_;
-    std::unique_ptr<Epoller> epoller_;
-    std::unordered_map<int, HttpConn> users_;
+    std::unique_ptr<ThreadPool> threadpool_;    // 快速通道：读写和静态资源，仅单Reactor模式使用
+    std::unique_ptr<ThreadPool> dbPool_;        // 数据库通道：登录/注册，线程数等于数据库连接数，排队有上限
+    std::unique_ptr<ConnTable> users_;          // 以fd为下标的连接表
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::vector<std::thread> loopThreads_;      // 除主线程外的事件循环线程
 };
 
 
@@ -10,12 +10,11 @@ void HeapTimer::SwapNode_(size_t i, size_t j) {
 
 void HeapTimer::siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size());
-    size_t parent = (i-1) / 2;
-    while(parent >= 0) {
+    while(i > 0) {  // size_t恒大于等于0，要以i判断是否到了堆顶
+        size_t parent = (i-1) / 2;
         if(heap_[parent] > heap_[i]) {
             SwapNode_(i, parent);
             i = parent;
-            parent = (i-1)/2;
         } else {
             break;
         }
@@ -36,8 +35,9 @@ bool HeapTimer::siftdown_(size_t i, size_t n) {
             SwapNode_(index, child);
             index = child;
             child = 2*child+1;
+        } else {
+            break;  // 不比子结点大，已经到位
         }
-        break;  // 需要跳出循环
     }
     return index > i;
 }
@@ -0,0 +1,52 @@
+#include "loopclock.h"
+
+std::atomic<bool> LoopClock::driven_(false);
+std::atomic<int64_t> LoopClock::monoMs_(0);
+std::atomic<int64_t> LoopClock::realUs_(0);
+
+void LoopClock::Update() {
+    driven_.store(true, std::memory_order_relaxed);
+    Sample_();
+}
+
+// 多个事件循环同时采样时只让时间往前走，单调时间不会被别的线程写回去
+void LoopClock::Sample_() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    int64_t ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    int64_t old = monoMs_.load(std::memory_order_relaxed);
+    while(old < ms && !monoMs_.compare_exchange_weak(old, ms, std::memory_order_relaxed)) {}
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    realUs_.store(ts.tv_sec * 1000000LL + ts.tv_nsec / 1000, std::memory_order_relaxed);
+}
+
+int64_t LoopClock::NowMs() {
+    if(!driven_.load(std::memory_order_relaxed)) { Sample_(); }
+    return monoMs_.load(std::memory_order_relaxed);
+}
+
+const LoopClock::WallTime& LoopClock::Wall() {
+    thread_local WallTime wall;
+    thread_local int64_t lastUs = 0;
+    if(!driven_.load(std::memory_order_relaxed)) { Sample_(); }
+    int64_t us = realUs_.load(std::memory_order_relaxed);
+    // 多个事件循环各自采样，本线程可能先读到新的再读到稍旧的；超过一个等待上限的回退是系统时间被调了，照实反映
+    if(us <= lastUs && lastUs - us < MAX_STALE_MS * 1000LL) {
+        us = lastUs + 1;
+    }
+    lastUs = us;
+    time_t sec = us / 1000000;
+    wall.usec = us % 1000000;
+    if(sec != wall.sec) {
+        wall.sec = sec;
+        localtime_r(&sec, &wall.local);
+        strftime(wall.logStamp, sizeof(wall.logStamp), "%Y-%m-%d %H:%M:%S", &wall.local);
+        struct tm gmt;
+        gmtime_r(&sec, &gmt);
+        char buf[64];
+        size_t len = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+        wall.httpDate.assign(buf, len);
+    }
+    return wall;
+}
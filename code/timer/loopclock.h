@@ -0,0 +1,41 @@
+#ifndef LOOP_CLOCK_H
+#define LOOP_CLOCK_H
+
+#include <time.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+/*
+事件循环共享的粗粒度时钟：每轮事件循环在epoll_wait返回后调用一次Update采样，定时器、日志和响应头都读缓存的值
+事件循环的等待时间不超过MAX_STALE_MS，没有事件时也按这个间隔采样，工作线程读到的值最多旧这么久
+单调时间用CLOCK_MONOTONIC_COARSE，墙上时间用CLOCK_REALTIME_COARSE，都走vDSO，精度为一个时钟节拍（几毫秒）
+格式化好的本地时间和HTTP-date按线程缓存，秒数变化时才重新localtime_r/gmtime_r
+同一个线程读到的微秒数严格递增：同一节拍内重复的或比上次稍早的采样往后顺延1微秒，日志里的先后顺序不乱
+还没有事件循环在运行时（如测试程序），每次读取都现场采样
+*/
+class LoopClock {
+public:
+    struct WallTime {
+        time_t sec = -1;
+        long usec = 0;
+        struct tm local;        // 本地时间
+        char logStamp[32];      // 日志行首的时间，如 2024-01-31 12:00:00
+        std::string httpDate;   // Date首部的值，如 Wed, 31 Jan 2024 04:00:00 GMT
+    };
+
+    static void Update();               // 事件循环每轮调用一次
+    static int64_t NowMs();             // 单调时间，毫秒
+    static const WallTime& Wall();      // 本线程的墙上时间缓存
+
+    static const int MAX_STALE_MS = 1000;   // 缓存的时间最多旧多久，事件循环的等待时间上限
+
+private:
+    static void Sample_();
+
+    static std::atomic<bool> driven_;       // 是否有事件循环在调用Update
+    static std::atomic<int64_t> monoMs_;
+    static std::atomic<int64_t> realUs_;
+};
+
+#endif //LOOP_CLOCK_H
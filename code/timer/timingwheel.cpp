@@ -0,0 +1,172 @@
+#include "timingwheel.h"
+
+TimingWheel::TimingWheel() : cur_(NowMs_()), count_(0) {
+    std::fill(heads_, heads_ + LEVELS * SLOTS, -1);
+    memset(bitmap_, 0, sizeof(bitmap_));
+}
+
+int64_t TimingWheel::NowMs_() {
+    return LoopClock::NowMs();  // 事件循环每轮采样一次，不在每次add/adjust时读时钟
+}
+
+// earliest：最早的到期时刻，已经过期的新定时器放到下一毫秒触发
+void TimingWheel::Link_(int id, int64_t earliest) {
+    Node& node = nodes_[id];
+    if(node.expires < earliest) { node.expires = earliest; }
+    if(node.expires - cur_ > MAX_SPAN) { node.expires = cur_ + MAX_SPAN; }
+    // 到期时刻和当前时刻在第level层以上的各位相同
+    uint64_t diff = static_cast<uint64_t>(node.expires ^ cur_);
+    int level = 0;
+    while(level < LEVELS - 1 && (diff >> (SLOT_BITS * (level + 1))) != 0) {
+        level++;
+    }
+    int idx = (node.expires >> (SLOT_BITS * level)) & (SLOTS - 1);
+    int slot = level * SLOTS + idx;
+    node.slot = slot;
+    node.prev = -1;
+    node.next = heads_[slot];
+    if(node.next != -1) { nodes_[node.next].prev = id; }
+    heads_[slot] = id;
+    bitmap_[level][idx / 64] |= 1ULL << (idx % 64);
+}
+
+void TimingWheel::Unlink_(int id) {
+    Node& node = nodes_[id];
+    assert(node.slot >= 0);
+    if(node.prev != -1) { nodes_[node.prev].next = node.next; }
+    else { heads_[node.slot] = node.next; }
+    if(node.next != -1) { nodes_[node.next].prev = node.prev; }
+    if(heads_[node.slot] == -1) {
+        int level = node.slot / SLOTS, idx = node.slot % SLOTS;
+        bitmap_[level][idx / 64] &= ~(1ULL << (idx % 64));
+    }
+    node.slot = node.prev = node.next = -1;
+}
+
+void TimingWheel::add(int id, int timeOut, const TimeoutCallBack& cb) {
+    assert(id >= 0);
+    if(static_cast<size_t>(id) >= nodes_.size()) {
+        nodes_.resize(id + 1);
+    }
+    if(nodes_[id].slot >= 0) {
+        Unlink_(id);
+    } else {
+        count_++;
+    }
+    nodes_[id].expires = NowMs_() + timeOut;
+    nodes_[id].cb = cb;
+    Link_(id, cur_ + 1);
+}
+
+void TimingWheel::adjust(int id, int newExpires) {
+    if(static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slot < 0) {
+        return;
+    }
+    Unlink_(id);
+    nodes_[id].expires = NowMs_() + newExpires;
+    Link_(id, cur_ + 1);
+}
+
+void TimingWheel::doWork(int id) {
+    if(static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slot < 0) {
+        return;
+    }
+    Unlink_(id);
+    count_--;
+    TimeoutCallBack cb = std::move(nodes_[id].cb);
+    nodes_[id].cb = nullptr;
+    cb();
+}
+
+void TimingWheel::del(int id) {
+    if(static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slot < 0) {
+        return;
+    }
+    Unlink_(id);
+    count_--;
+    nodes_[id].cb = nullptr;
+}
+
+void TimingWheel::clear() {
+    for(Node& node : nodes_) {
+        node = Node();
+    }
+    std::fill(heads_, heads_ + LEVELS * SLOTS, -1);
+    memset(bitmap_, 0, sizeof(bitmap_));
+    count_ = 0;
+}
+
+void TimingWheel::Cascade_(int level) {
+    int slot = level * SLOTS + ((cur_ >> (SLOT_BITS * level)) & (SLOTS - 1));
+    int id = heads_[slot];
+    heads_[slot] = -1;
+    bitmap_[level][(slot % SLOTS) / 64] &= ~(1ULL << (slot % 64));
+    while(id != -1) {
+        int next = nodes_[id].next;
+        Link_(id, cur_);    // 到期时刻正好是现在的放进第0层当前槽，随后就触发
+        id = next;
+    }
+}
+
+// 第level层当前槽之后第一个非空的槽，它的起点就是下一次要处理的时刻；低层的事件总是早于高层
+int64_t TimingWheel::NextEvent_() const {
+    for(int level = 0; level < LEVELS; level++) {
+        int shift = SLOT_BITS * level;
+        int from = ((cur_ >> shift) & (SLOTS - 1)) + 1;
+        for(int w = from / 64; w < SLOTS / 64; w++) {
+            uint64_t bits = bitmap_[level][w];
+            if(w == from / 64) { bits &= ~0ULL << (from % 64); }
+            if(bits) {
+                int64_t idx = w * 64 + __builtin_ctzll(bits);
+                return ((cur_ >> (shift + SLOT_BITS)) << (shift + SLOT_BITS)) + (idx << shift);
+            }
+        }
+    }
+    // 顶层绕回：到期时刻在下一圈
+    int shift = SLOT_BITS * (LEVELS - 1);
+    for(int w = 0; w < SLOTS / 64; w++) {
+        if(bitmap_[LEVELS - 1][w]) {
+            int64_t idx = w * 64 + __builtin_ctzll(bitmap_[LEVELS - 1][w]);
+            return (((cur_ >> (shift + SLOT_BITS)) + 1) << (shift + SLOT_BITS)) + (idx << shift);
+        }
+    }
+    return INT64_MAX;
+}
+
+void TimingWheel::tick() {
+    int64_t now = NowMs_();
+    while(cur_ < now) {
+        int64_t next = count_ > 0 ? NextEvent_() : INT64_MAX;
+        if(next > now) {
+            cur_ = now;     // 中间没有需要处理的槽，直接跳过去
+            break;
+        }
+        cur_ = next;
+        // 先从高层往低层下放，再触发第0层当前槽
+        for(int level = LEVELS - 1; level > 0; level--) {
+            if((cur_ & ((1LL << (SLOT_BITS * level)) - 1)) == 0) {
+                Cascade_(level);
+            }
+        }
+        int slot = cur_ & (SLOTS - 1);
+        while(heads_[slot] != -1) {
+            int id = heads_[slot];
+            Unlink_(id);
+            count_--;
+            TimeoutCallBack cb = std::move(nodes_[id].cb);  // 回调里可能再add，不能引用nodes_中的元素
+            nodes_[id].cb = nullptr;
+            cb();
+        }
+    }
+}
+
+int TimingWheel::GetNextTick() {
+    tick();
+    if(count_ == 0) {
+        return -1;
+    }
+    int64_t res = NextEvent_() - cur_;
+    if(res < 0) { res = 0; }
+    if(res > INT32_MAX) { res = INT32_MAX; }
+    return static_cast<int>(res);
+}
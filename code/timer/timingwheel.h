@@ -0,0 +1,62 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>     // memset
+#include <assert.h>
+#include "heaptimer.h"
+#include "loopclock.h"
+
+/*
+分层时间轮，替代HeapTimer，接口相同（add/adjust/doWork/tick/GetNextTick）
+精度1ms，4层、每层256个槽，超过2^31ms（约24天）的超时按2^31ms处理
+结点按id（即fd）放在数组里，槽中是以下标串起来的双向链表，add、adjust、doWork都是O(1)，没有哈希表也不移动结点
+结点放在第L层，当且仅当它的到期时间和当前时间在第L层以上的各位都相同；当前时间走到某个槽的起点时，把槽里的结点重新放到更低的层
+每层用位图记录非空的槽，GetNextTick和tick据此直接跳到下一个需要处理的时刻，不逐毫秒空转
+*/
+class TimingWheel {
+public:
+    TimingWheel();
+    ~TimingWheel() { clear(); }
+
+    void adjust(int id, int newExpires);
+    void add(int id, int timeOut, const TimeoutCallBack& cb); // 添加一个定时器，id已存在时更新超时时间和回调
+    void doWork(int id);    // 删除指定id，并触发回调函数
+    void del(int id);       // 删除指定id，不触发回调
+    void clear();
+    void tick();            // 触发所有已到期的定时器
+    int GetNextTick();      // 距下一次需要tick的毫秒数，没有定时器时返回-1
+
+    size_t size() const { return count_; }
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 8;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int64_t MAX_SPAN = 1LL << (LEVELS * SLOT_BITS - 1);   // 不超过顶层一圈的一半，绕回时不会和当前槽重叠
+
+    struct Node {
+        int prev = -1;
+        int next = -1;
+        int slot = -1;      // 所在的槽（层 * SLOTS + 槽号），-1表示没有定时器
+        int64_t expires = 0;
+        TimeoutCallBack cb;
+    };
+
+    static int64_t NowMs_();
+    void Link_(int id, int64_t earliest);   // 按expires放入对应的槽，早于earliest的按earliest处理
+    void Unlink_(int id);
+    void Cascade_(int level);   // 当前时间到达第level层某个槽的起点，把槽里的结点放到低层
+    int64_t NextEvent_() const; // 下一个需要处理（触发或下放）的时刻
+
+    int64_t cur_;       // 已经处理到的时刻（ms）
+    size_t count_;
+    std::vector<Node> nodes_;               // 以id为下标
+    int heads_[LEVELS * SLOTS];             // 每个槽的链表头
+    uint64_t bitmap_[LEVELS][SLOTS / 64];   // 非空的槽
+};
+
+#endif //TIMING_WHEEL_H
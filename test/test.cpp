@@ -1,12 +1,43 @@
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/httpconn.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/timer/timingwheel.h"
+#include "../code/server/conntable.h"
+#include "../code/server/epoller.h"
 #include <features.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <regex>
+#include <unordered_map>
+#include <random>
+#include <thread>
+#include <queue>
+#include <condition_variable>
+#include <memory>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
 #define gettid() syscall(SYS_gettid)
 #endif
 
+// 统计本线程的堆分配次数，用来检查解析请求时有没有分配内存
+static thread_local size_t allocCount = 0;
+
+// 都不内联：GCC把内联进来的malloc/free和operator new/delete配对时会误报-Wmismatched-new-delete
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocCount++;
+    if(void* p = malloc(size ? size : 1)) { return p; }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
 void TestLog() {
     int cnt = 0, level = 0;
     Log::Instance()->init(level, "./testlog1", ".log", 0);
@@ -45,7 +76,1346 @@ void TestThreadPool() {
     getchar();
 }
 
+// 原先基于std::regex逐行解析的实现，作为解析器吞吐量的对照
+static bool LegacyParse(Buffer& buff, std::unordered_map<std::string, std::string>& header) {
+    const char END[] = "\r\n";
+    int state = 0;
+    while(buff.ReadableBytes() && state != 2) {
+        const char* lineend = std::search(buff.Peek(), buff.BeginWriteConst(), END, END+2);
+        std::string line(buff.Peek(), lineend);
+        if(state == 0) {
+            std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+            std::smatch Match;
+            if(!std::regex_match(line, Match, patten)) { return false; }
+            state = 1;
+        } else {
+            std::regex patten("^([^:]*): ?(.*)$");
+            std::smatch Match;
+            if(std::regex_match(line, Match, patten)) {
+                header[Match[1]] = Match[2];
+            } else {
+                state = 2;
+            }
+        }
+        if(lineend == buff.BeginWrite()) { buff.RetrieveAll(); break; }
+        buff.RetrieveUntil(lineend + 2);
+    }
+    return true;
+}
+
+void TestParserBench() {
+    const std::string req =
+        "GET /css/bootstrap.min.css HTTP/1.1\r\n"
+        "Host: 127.0.0.1:1316\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: text/css,*/*;q=0.1\r\n"
+        "Referer: http://127.0.0.1:1316/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=zh-CN\r\n"
+        "\r\n";
+    const int N = 100000;
+    const int LEGACY_N = 2000;  // regex太慢，少跑一些，按每秒请求数比较
+    Buffer buff;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < LEGACY_N; i++) {
+        std::unordered_map<std::string, std::string> header;
+        buff.Append(req);
+        LegacyParse(buff, header);
+        buff.RetrieveAll();
+    }
+    double legacy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    HttpRequest request;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++) {
+        buff.Append(req);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::COMPLETE);
+    }
+    double parser = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // 请求对象复用时，解析一个普通的GET请求不分配内存；首部名字不区分大小写
+    size_t allocs = allocCount;
+    for(int i = 0; i < 1000; i++) {
+        buff.Append(req);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::COMPLETE);
+    }
+    allocs = allocCount - allocs;
+    assert(allocs == 0);
+    assert(request.method() == "GET" && request.version() == "1.1");
+    assert(request.Header(HttpRequest::ACCEPT_ENCODING) == "gzip, deflate, br");
+    assert(request.GetHeader("cookie") == request.Header(HttpRequest::COOKIE) && !request.GetHeader("Cookie").empty());
+    assert(request.GetHeader("accept-language") == "zh-CN,zh;q=0.9,en;q=0.8");
+    assert(request.GetHeader("X-Missing").empty());
+
+    // 每次只到达一个字节，检查续读的结果和一次到达相同
+    for(size_t i = 0; i < req.size(); i++) {
+        buff.Append(req.data() + i, 1);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == (i + 1 == req.size() ? HttpRequest::COMPLETE : HttpRequest::INCOMPLETE));
+    }
+    assert(request.path() == "/css/bootstrap.min.css" && request.IsKeepAlive());
+
+    printf("parse: regex %.0f req/s, state machine %.0f req/s, %zu allocations per 1000 requests\n", LEGACY_N / legacy, N / parser, allocs);
+}
+
+// 消息体：Content-Length和chunked在任意位置断开时结果相同，大的写临时文件，超过上限回413，Expect: 100-continue只提示一次
+void TestRequestBody() {
+    std::string body;
+    for(int i = 0; i < 300; i++) { body += "line " + std::to_string(i) + "\r\n"; }    // 消息体里有CRLF
+    const std::string next = "GET /index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    std::string chunked = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    for(size_t pos = 0; pos < body.size(); pos += 1000) {
+        size_t n = std::min<size_t>(1000, body.size() - pos);
+        char size[32];
+        snprintf(size, sizeof(size), "%zx;ext=1\r\n", n);
+        chunked += size + body.substr(pos, n) + "\r\n";
+    }
+    chunked += "0\r\nX-Trailer: 1\r\n\r\n";
+    const std::string sized = "POST /upload HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    const std::string* reqs[] = { &sized, &chunked };
+
+    for(const std::string* req : reqs) {
+        for(size_t split : { size_t(1), size_t(7), size_t(1000), req->size() }) {
+            Buffer buff(0, true);
+            HttpRequest request;
+            std::string all = *req + next;
+            HttpRequest::PARSE_RESULT ret = HttpRequest::INCOMPLETE;
+            for(size_t pos = 0; pos < all.size() && ret == HttpRequest::INCOMPLETE; pos += split) {
+                buff.Append(all.data() + pos, std::min(split, all.size() - pos));
+                ret = request.parse(buff);
+            }
+            if(ret == HttpRequest::INCOMPLETE) { ret = request.parse(buff); }
+            assert(ret == HttpRequest::COMPLETE);
+            assert(request.method() == "POST" && request.body() == body && request.BodyLen() == body.size());
+            while(buff.ReadableBytes() < next.size()) { buff.Append(all.data() + all.size() - next.size() + buff.ReadableBytes(), 1); }
+            ret = request.parse(buff);
+            assert(ret == HttpRequest::COMPLETE && request.path() == "/index.html");
+        }
+    }
+
+    // 超过spillBytes：消息体不在内存里，从临时文件读出来和原文一致
+    size_t spill = HttpRequest::spillBytes;
+    HttpRequest::spillBytes = 1024;
+    for(const std::string* req : reqs) {
+        Buffer buff(0, true);
+        HttpRequest request;
+        buff.Append(*req);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::COMPLETE);
+        assert(request.body().empty() && request.BodyFd() >= 0 && request.BodyLen() == body.size());
+        std::string saved(body.size(), '\0');
+        ssize_t n = pread(request.BodyFd(), &saved[0], saved.size(), 0);
+        assert(n == static_cast<ssize_t>(saved.size()));
+        assert(saved == body);
+    }
+    HttpRequest::spillBytes = spill;
+
+    // 超过maxBodyBytes：不等消息体到达就回413
+    size_t maxBody = HttpRequest::maxBodyBytes;
+    HttpRequest::maxBodyBytes = 1024;
+    for(const std::string* req : reqs) {
+        Buffer buff(0, true);
+        HttpRequest request;
+        buff.Append(*req);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::BAD_REQUEST && request.ErrorCode() == 413);
+    }
+    HttpRequest::maxBodyBytes = maxBody;
+
+    const char* bad[] = {
+        "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 5x\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nabc\r\n",
+    };
+    for(const char* req : bad) {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(req, strlen(req));
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::BAD_REQUEST && request.ErrorCode() == 400);
+    }
+
+    Buffer buff;
+    HttpRequest request;
+    buff.Append("POST /upload HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 3\r\n\r\n");
+    HttpRequest::PARSE_RESULT ret = request.parse(buff);
+    assert(ret == HttpRequest::INCOMPLETE);
+    bool first = request.TakeContinue(), second = request.TakeContinue();
+    assert(first && !second);
+    buff.Append("abc");
+    ret = request.parse(buff);
+    assert(ret == HttpRequest::COMPLETE && request.body() == "abc");
+    printf("request body: content-length, chunked, spill to file, 413, 100-continue ok\n");
+}
+
+// multipart：任意位置断开时各部分的内容不变（数据里有分隔符的前半截），文件存到uploadDir或交给回调，只在上传页面接受
+void TestMultipart() {
+    const std::string boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+    std::mt19937 rng(11);
+    std::string file(300000, '\0');
+    for(char& ch : file) { ch = static_cast<char>(rng()); }
+    for(size_t i = 0; i + 100 < file.size(); i += 7919) {
+        std::string trap = "\r\n--" + boundary.substr(0, i % boundary.size());    // 分隔符的前半截
+        file.replace(i, trap.size(), trap);
+    }
+    const std::string field = "hello\r\n--world";
+    std::string body = "preamble\r\n--" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\n" + field + "\r\n--" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"video\"; filename=\"C:\\tmp\\a;b.bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n" + file + "\r\n--" + boundary + "--\r\nepilogue";
+
+    for(size_t split : { size_t(1), size_t(2), size_t(5), size_t(37), size_t(4096), body.size() }) {
+        std::vector<std::pair<MultipartParser::Part, std::string>> parts;
+        bool ended = true;
+        MultipartParser parser(
+            [&](const MultipartParser::Part& part) { parts.push_back({ part, "" }); ended = false; return true; },
+            [&](const char* data, size_t len) { parts.back().second.append(data, len); return true; },
+            [&]() { ended = true; return true; });
+        parser.Reset(MultipartParser::Boundary("multipart/form-data; boundary=" + boundary));
+        for(size_t pos = 0; pos < body.size(); pos += split) {
+            bool ok = parser.Feed(body.data() + pos, std::min(split, body.size() - pos));
+            assert(ok);
+        }
+        assert(parser.Done() && ended && parts.size() == 2);
+        assert(parts[0].first.name == "title" && parts[0].first.filename.empty() && parts[0].second == field);
+        assert(parts[1].first.name == "video" && parts[1].first.filename == "C:\\tmp\\a;b.bin");
+        assert(parts[1].first.contentType == "application/octet-stream" && parts[1].second == file);
+    }
+    assert(MultipartParser::Boundary("multipart/form-data; boundary=\"a b\"") == "a b");
+    assert(MultipartParser::Boundary("application/x-www-form-urlencoded").empty());
+
+    // 经过HttpRequest：文件按块到达，存到uploadDir，普通字段进GetPost
+    char dir[] = "/tmp/webserver-upload-XXXXXX";
+    char* made = mkdtemp(dir);
+    assert(made);
+    HttpRequest::uploadDir = dir;
+    const std::string req = "POST /video HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=" + boundary +
+        "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    std::vector<std::string> saved;
+    for(int round = 0; round < 2; round++) {    // 第二次同名，换一个名字，不覆盖第一个
+        Buffer buff(0, true);
+        HttpRequest request;
+        HttpRequest::PARSE_RESULT ret = HttpRequest::INCOMPLETE;
+        for(size_t pos = 0; pos < req.size(); pos += 65536) {
+            buff.Append(req.data() + pos, std::min<size_t>(65536, req.size() - pos));
+            ret = request.parse(buff);
+        }
+        assert(ret == HttpRequest::COMPLETE && request.GetPost("title") == field && request.uploads().size() == 1);
+        const HttpRequest::Upload& up = request.uploads()[0];
+        assert(up.size == file.size() && up.path == std::string(dir) + (round == 0 ? "/a;b.bin" : "/1-a;b.bin"));
+        std::string content(file.size(), '\0');
+        int fd = open(up.path.c_str(), O_RDONLY);
+        ssize_t n = read(fd, &content[0], content.size());
+        assert(fd >= 0 && n == static_cast<ssize_t>(content.size()));
+        close(fd);
+        assert(content == file);
+        saved.push_back(up.path);
+    }
+    for(const std::string& path : saved) { unlink(path.c_str()); }
+
+    // 没收完就断开：临时文件被删掉，目录里什么都不留
+    {
+        Buffer buff(0, true);
+        HttpRequest request;
+        buff.Append(req.data(), req.size() / 2);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::INCOMPLETE);
+    }
+    int rc = rmdir(dir);
+    assert(rc == 0);
+
+    // 回调模式：文件不落盘
+    size_t received = 0;
+    HttpRequest::uploadCallback = [&received](const MultipartParser::Part&, const char*, size_t len, bool) {
+        received += len;
+        return true;
+    };
+    {
+        Buffer buff(0, true);
+        HttpRequest request;
+        buff.Append(req);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::COMPLETE && received == file.size());
+        assert(request.uploads().size() == 1 && request.uploads()[0].path.empty());
+    }
+    HttpRequest::uploadCallback = nullptr;
+
+    // 缺少结束分隔符时回400
+    std::string truncated = "POST /video HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=" + boundary +
+        "\r\nContent-Length: 80\r\n\r\n--" + boundary + "\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n";
+    truncated.resize(truncated.size() + 80 - (truncated.size() - truncated.find("\r\n\r\n") - 4), 'x');
+    {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(truncated);
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::BAD_REQUEST && request.ErrorCode() == 400);
+    }
+
+    // 只看首部就能决定：上传页面以外的multipart回415，没有上传目录和回调时回403，
+    // 上传页面的multipart按maxUploadBytes限制，其他消息体仍按maxBodyBytes
+    size_t oldMaxBody = HttpRequest::maxBodyBytes, oldMaxUpload = HttpRequest::maxUploadBytes;
+    HttpRequest::maxBodyBytes = 1 << 20;
+    HttpRequest::maxUploadBytes = 1 << 30;
+    const std::string multipartType = "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n";
+    const std::string formType = "Content-Type: application/x-www-form-urlencoded\r\n";
+    struct { const char* path; const std::string* type; const char* dir; size_t len; HttpRequest::PARSE_RESULT ret; int code; } cases[] = {
+        { "/picture", &multipartType, "/tmp", 100 << 20, HttpRequest::INCOMPLETE, 0 },
+        { "/video", &multipartType, "/tmp", (1 << 30) + 1, HttpRequest::BAD_REQUEST, 413 },
+        { "/login", &multipartType, "/tmp", 100, HttpRequest::BAD_REQUEST, 415 },
+        { "/upload", &multipartType, "/tmp", 100, HttpRequest::BAD_REQUEST, 415 },
+        { "/picture", &multipartType, nullptr, 100, HttpRequest::BAD_REQUEST, 403 },
+        { "/picture", &formType, "/tmp", 100 << 20, HttpRequest::BAD_REQUEST, 413 },
+        { "/login", &formType, "/tmp", 100 << 20, HttpRequest::BAD_REQUEST, 413 },
+    };
+    for(const auto& c : cases) {
+        HttpRequest::uploadDir = c.dir;
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(std::string("POST ") + c.path + " HTTP/1.1\r\nExpect: 100-continue\r\n" + *c.type +
+                    "Content-Length: " + std::to_string(c.len) + "\r\n\r\n");
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == c.ret);
+        bool expected = ret == HttpRequest::INCOMPLETE ? request.TakeContinue() : request.ErrorCode() == c.code;
+        assert(expected);
+    }
+    HttpRequest::uploadDir = nullptr;
+    HttpRequest::maxBodyBytes = oldMaxBody;
+    HttpRequest::maxUploadBytes = oldMaxUpload;
+    printf("multipart: %zuKB upload at every split ok\n", file.size() >> 10);
+}
+
+// 响应测试用的资源目录：在临时目录里建文件，mtime往前调sec秒（负数往后），析构时删掉
+struct TempSite {
+    std::string dir;
+    std::vector<std::string> files;
+    TempSite() {
+        char tmpl[] = "/tmp/webserver-site-XXXXXX";
+        char* made = mkdtemp(tmpl);
+        assert(made);
+        dir = tmpl;
+    }
+    ~TempSite() {
+        for(const std::string& f : files) { unlink((dir + f).c_str()); }
+        rmdir(dir.c_str());
+    }
+    void Write(const std::string& path, const std::string& content, int ageSec = 0) {
+        std::string full = dir + path;
+        int fd = open(full.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ssize_t n = write(fd, content.data(), content.size());
+        assert(fd >= 0 && n == static_cast<ssize_t>(content.size()));
+        close(fd);
+        struct timespec ts[2];
+        clock_gettime(CLOCK_REALTIME, &ts[0]);
+        ts[0].tv_sec -= ageSec;
+        ts[1] = ts[0];
+        int rc = utimensat(AT_FDCWD, full.c_str(), ts, 0);
+        assert(rc == 0);
+        files.push_back(path);
+    }
+};
+
+// 生成一个GET响应，把首部和消息体（写缓冲区中的文本和映射的文件段）按发送顺序拼起来
+static std::string Render(HttpResponse& response) {
+    Buffer buff;
+    response.MakeResponse(buff);
+    std::string out;
+    for(const HttpResponse::Segment& seg : response.Segments()) {
+        if(seg.inBuff) {
+            out.append(buff.Peek() + seg.offset, seg.len);
+        } else {
+            assert(response.File());
+            out.append(response.File() + seg.offset, seg.len);
+        }
+    }
+    return out;
+}
+
+// 响应首部的值，没有时返回"-"
+static std::string HeaderOf(const std::string& resp, const std::string& name) {
+    size_t pos = resp.find("\r\n" + name + ": ");
+    if(pos == std::string::npos || pos > resp.find("\r\n\r\n")) { return "-"; }
+    pos += name.size() + 4;
+    return resp.substr(pos, resp.find("\r\n", pos) - pos);
+}
+
+// Accept-Encoding按q值选编码，q相同时br优先；比原文件旧的预压缩文件不用
+void TestContentEncoding() {
+    TempSite site;
+    std::string text;
+    for(int i = 0; i < 200; i++) { text += "<p>line " + std::to_string(i) + " of compressible text</p>\n"; }
+    site.Write("/a.html", text);
+    site.Write("/stale.html", text);
+    site.Write("/stale.html.gz", "STALE", 60);       // 比原文件早一分钟
+    site.Write("/fresh.html", text, 60);
+    site.Write("/fresh.html.gz", "FRESH");
+    FileCache::Instance()->Init(site.dir, 64, 1 << 20, 1 << 20);
+
+    struct { const char* accept; const char* expect; } cases[] = {
+        { "br;q=0.1, gzip;q=1", "gzip" },
+        { "gzip, br", "br" },
+        { "gzip;q=0.5, br;q=0.5", "br" },
+        { "gzip;q=0.8, br;q=0.9", "br" },
+        { "gzip ; q=0.9, br;q=0.3", "gzip" },
+        { "deflate, GZIP", "gzip" },
+        { "x-gzip", "gzip" },
+        { "br;q=0, gzip", "gzip" },
+        { "gzip;q=0, br;q=0", "-" },
+        { "*;q=0.5, br;q=0.2", "gzip" },
+        { "*", "br" },
+        { "identity", "-" },
+        { "", "-" },
+    };
+    std::string srcDir = site.dir + "/";
+    for(const auto& c : cases) {
+        HttpResponse response;
+        std::string path = "/a.html";
+        response.Init(srcDir, path, false, 200);
+        response.SetAcceptEncoding(c.accept);
+        std::string resp = Render(response);
+        std::string got = HeaderOf(resp, "Content-Encoding");
+        if(got != c.expect) { printf("Accept-Encoding: %s -> %s, want %s\n", c.accept, got.c_str(), c.expect); }
+        assert(got == c.expect);
+        assert(HeaderOf(resp, "Vary") == "Accept-Encoding");
+    }
+
+    // 预压缩文件比原文件旧时现场压缩，不比原文件旧时直接用
+    std::shared_ptr<const CachedFile> stale = FileCache::Instance()->Get(site.dir + "/stale.html");
+    std::shared_ptr<const CachedFile> fresh = FileCache::Instance()->Get(site.dir + "/fresh.html");
+    assert(stale && fresh);
+    std::shared_ptr<const CachedFile> enc = FileCache::Instance()->GetEncoded(site.dir + "/stale.html", *stale, Compressor::GZIP);
+    assert(enc && enc->data && std::string(enc->data, enc->st.st_size) != "STALE");
+    assert(enc->etag == HttpResponse::EncodedETag(stale->etag, Compressor::GZIP));
+    enc = FileCache::Instance()->GetEncoded(site.dir + "/fresh.html", *fresh, Compressor::GZIP);
+    assert(enc && enc->data && std::string(enc->data, enc->st.st_size) == "FRESH");
+    enc.reset();
+    stale.reset();
+    fresh.reset();
+    FileCache::Instance()->Close();
+    printf("content encoding: %zu Accept-Encoding cases, stale .gz ignored ok\n", sizeof(cases) / sizeof(cases[0]));
+}
+
+// 解析一个GET请求，按它的Range和If-Range生成对文件path的响应
+static std::string RangeResponse(const std::string& srcDir, const std::string& path,
+                                 const std::string& range, const std::string& ifRange = "") {
+    Buffer buff;
+    buff.Append("GET " + path + " HTTP/1.1\r\nRange: " + range + "\r\n" +
+                (ifRange.empty() ? "" : "If-Range: " + ifRange + "\r\n") + "\r\n");
+    HttpRequest request;
+    HttpRequest::PARSE_RESULT ret = request.parse(buff);
+    assert(ret == HttpRequest::COMPLETE);
+    HttpResponse response;
+    std::string reqPath = request.path();
+    response.Init(srcDir, reqPath, false, 200);
+    response.SetRange(request.ranges(), request.Header(HttpRequest::IF_RANGE));
+    return Render(response);
+}
+
+// Range：首部的解析（后缀、开放区间、格式错误、空元素、单位大小写），按文件大小换算和416，If-Range，multipart/byteranges的布局
+void TestRange() {
+    typedef std::vector<HttpRequest::ByteRange> Ranges;
+    struct { const char* header; Ranges expect; } parses[] = {
+        { "bytes=0-99", { { 0, 99 } } },
+        { "bytes=-500", { { -1, 500 } } },
+        { "bytes=9500-", { { 9500, -1 } } },
+        { "Bytes=0-1", { { 0, 1 } } },
+        { "BYTES=0-1, 5-6", { { 0, 1 }, { 5, 6 } } },
+        { "bytes=0-1,,5-6", { { 0, 1 }, { 5, 6 } } },
+        { "bytes= 0-1 , ,\t-5", { { 0, 1 }, { -1, 5 } } },
+        { "bytes=,", {} },
+        { "bytes=", {} },
+        { "bytes=5-1", {} },
+        { "bytes=-", {} },
+        { "bytes=a-1", {} },
+        { "bytes=0-1,x", {} },
+        { "bytes=0-1-2", {} },
+        { "bytes=0-99999999999999999999", {} },
+        { "items=0-1", {} },
+    };
+    for(const auto& c : parses) {
+        Buffer buff;
+        buff.Append(std::string("GET /a HTTP/1.1\r\nRange: ") + c.header + "\r\n\r\n");
+        HttpRequest request;
+        HttpRequest::PARSE_RESULT ret = request.parse(buff);
+        assert(ret == HttpRequest::COMPLETE);
+        if(request.ranges() != c.expect) { printf("Range: %s parsed wrong\n", c.header); }
+        assert(request.ranges() == c.expect);
+    }
+
+    TempSite site;
+    std::string text;
+    for(int i = 0; i < 1000; i++) { text += static_cast<char>('a' + i % 26); }
+    site.Write("/r.txt", text);
+    std::string srcDir = site.dir + "/";
+    auto body = [](const std::string& resp) { return resp.substr(resp.find("\r\n\r\n") + 4); };
+
+    // 单个范围：换算成闭区间，超出文件的部分截掉；一个都不满足时416并带上文件大小
+    struct { const char* range; const char* contentRange; size_t first, len; } singles[] = {
+        { "bytes=0-99", "bytes 0-99/1000", 0, 100 },
+        { "bytes=-100", "bytes 900-999/1000", 900, 100 },
+        { "bytes=-5000", "bytes 0-999/1000", 0, 1000 },
+        { "bytes=990-", "bytes 990-999/1000", 990, 10 },
+        { "bytes=900-5000", "bytes 900-999/1000", 900, 100 },
+        { "bytes=0-0, 2000-", "bytes 0-0/1000", 0, 1 },
+        { "bytes=1000-", "bytes */1000", 0, 0 },
+        { "bytes=-0", "bytes */1000", 0, 0 },
+        { "bytes=2000-3000, 5000-", "bytes */1000", 0, 0 },
+    };
+    for(const auto& c : singles) {
+        std::string resp = RangeResponse(srcDir, "/r.txt", c.range);
+        assert(HeaderOf(resp, "Content-Range") == c.contentRange);
+        if(c.len == 0) {
+            assert(resp.compare(0, 13, "HTTP/1.1 416 ") == 0);
+            assert(body(resp).find("Requested Range Not Satisfiable") != std::string::npos);
+        } else {
+            assert(resp.compare(0, 13, "HTTP/1.1 206 ") == 0);
+            assert(HeaderOf(resp, "Content-length") == std::to_string(c.len) && body(resp) == text.substr(c.first, c.len));
+        }
+    }
+    // 格式错误的Range整个忽略
+    std::string resp = RangeResponse(srcDir, "/r.txt", "bytes=5-1");
+    assert(resp.compare(0, 13, "HTTP/1.1 200 ") == 0 && body(resp) == text);
+
+    // If-Range：和ETag或Last-Modified一致时按范围，不一致（文件变了）或弱ETag时返回整个文件
+    std::string etag = HeaderOf(resp, "ETag"), lastModified = HeaderOf(resp, "Last-Modified");
+    for(const std::string& ifRange : { etag, lastModified }) {
+        resp = RangeResponse(srcDir, "/r.txt", "bytes=0-9", ifRange);
+        assert(resp.compare(0, 13, "HTTP/1.1 206 ") == 0 && body(resp) == text.substr(0, 10));
+    }
+    for(const std::string& ifRange : { std::string("\"other\""), "W/" + etag, std::string("Thu, 01 Jan 1970 00:00:00 GMT") }) {
+        resp = RangeResponse(srcDir, "/r.txt", "bytes=0-9", ifRange);
+        assert(resp.compare(0, 13, "HTTP/1.1 200 ") == 0 && HeaderOf(resp, "Content-Range") == "-" && body(resp) == text);
+    }
+
+    // 多个范围：每段一个分隔符和小头部，最后是结束分隔符，Content-length和实际长度一致
+    resp = RangeResponse(srcDir, "/r.txt", "bytes=0-9, 20-29, -5");
+    assert(resp.compare(0, 13, "HTTP/1.1 206 ") == 0 && HeaderOf(resp, "Content-Range") == "-");
+    std::string type = HeaderOf(resp, "Content-type");
+    const std::string prefix = "multipart/byteranges; boundary=";
+    assert(type.compare(0, prefix.size(), prefix) == 0);
+    std::string boundary = type.substr(prefix.size());
+    std::string expect;
+    for(auto r : { std::make_pair(0, 9), std::make_pair(20, 29), std::make_pair(995, 999) }) {
+        expect += "\r\n--" + boundary + "\r\nContent-type: text/plain\r\nContent-Range: bytes " +
+                  std::to_string(r.first) + "-" + std::to_string(r.second) + "/1000\r\n\r\n" +
+                  text.substr(r.first, r.second - r.first + 1);
+    }
+    expect += "\r\n--" + boundary + "--\r\n";
+    assert(body(resp) == expect && HeaderOf(resp, "Content-length") == std::to_string(expect.size()));
+    printf("range: %zu headers parsed, %zu single ranges, If-Range, multipart/byteranges ok\n",
+           sizeof(parses) / sizeof(parses[0]), sizeof(singles) / sizeof(singles[0]));
+}
+
+// 条件GET：If-None-Match（强、弱、*、列表、压缩版本的ETag），If-Modified-Since，两者都有时If-None-Match优先，304不带消息体
+void TestConditional() {
+    TempSite site;
+    std::string text(3000, 'c');
+    site.Write("/c.txt", text, 3600);   // 一小时前修改
+    std::string srcDir = site.dir + "/";
+    auto get = [&srcDir](const std::string& path, const std::string& inm, const std::string& ims, const std::string& accept = "") {
+        HttpResponse response;
+        std::string p = path;
+        response.Init(srcDir, p, false, 200);
+        response.SetAcceptEncoding(accept);
+        response.SetConditional(inm, ims);
+        return Render(response);
+    };
+    auto body = [](const std::string& resp) { return resp.substr(resp.find("\r\n\r\n") + 4); };
+    std::string resp = get("/c.txt", "", "");
+    assert(resp.compare(0, 13, "HTTP/1.1 200 ") == 0 && body(resp) == text);
+    const std::string etag = HeaderOf(resp, "ETag"), lastModified = HeaderOf(resp, "Last-Modified");
+    assert(etag.size() > 2 && etag.front() == '"' && lastModified != "-");
+    const std::string gzipTag = HttpResponse::EncodedETag(etag, Compressor::GZIP);
+
+    struct { std::string inm, ims, accept; int code; std::string tag; } cases[] = {
+        { etag, "", "", 304, etag },                                // 强ETag
+        { "W/" + etag, "", "", 304, etag },                         // 弱比较，忽略W/
+        { "*", "", "", 304, etag },
+        { "\"x\", " + etag + " ,\"y\"", "", "", 304, etag },         // 列表里有一个匹配
+        { "\"x\", W/\"y\"", "", "", 200, "" },
+        { "\"other\"", "", "", 200, "" },
+        { gzipTag, "", "gzip", 304, gzipTag },                      // 客户端缓存的是gzip版本
+        { gzipTag, "", "", 200, "" },                               // 现在不接受gzip，缓存的版本不能用
+        { "", lastModified, "", 304, "" },                          // 可压缩的文件不知道缓存的是哪个版本，不回ETag
+        { "", HttpResponse::HttpDate(time(nullptr) + 60), "", 304, "" },
+        { "", "Thu, 01 Jan 1970 00:00:00 GMT", "", 200, "" },
+        { "", "not a date", "", 200, "" },
+        { "\"other\"", lastModified, "", 200, "" },                // 两者都有时只看If-None-Match
+        { etag, "Thu, 01 Jan 1970 00:00:00 GMT", "", 304, etag },
+    };
+    for(const auto& c : cases) {
+        resp = get("/c.txt", c.inm, c.ims, c.accept);
+        int code = atoi(resp.c_str() + 9);
+        if(code != c.code) { printf("If-None-Match: %s If-Modified-Since: %s -> %d\n", c.inm.c_str(), c.ims.c_str(), code); }
+        assert(code == c.code);
+        if(code == 304) {
+            // 304只有首部：没有消息体、Content-length和Content-Encoding
+            assert(body(resp).empty() && HeaderOf(resp, "Content-length") == "-" && HeaderOf(resp, "Content-Encoding") == "-");
+            assert(HeaderOf(resp, "ETag") == (c.tag.empty() ? "-" : c.tag) && HeaderOf(resp, "Last-Modified") == lastModified);
+            assert(HeaderOf(resp, "Vary") == "Accept-Encoding");
+        } else {
+            assert(body(resp).size() == text.size() || HeaderOf(resp, "Content-Encoding") != "-");
+        }
+    }
+    // 文件不存在时不因为If-None-Match: *回304
+    resp = get("/missing.txt", "*", "");
+    assert(resp.compare(0, 13, "HTTP/1.1 404 ") == 0);
+    printf("conditional: %zu If-None-Match/If-Modified-Since cases ok\n", sizeof(cases) / sizeof(cases[0]));
+}
+
+// 文件存在但打不开（fd用完）：回500，不把错误信息当成200的消息体
+void TestOpenFailure() {
+    TempSite site;
+    site.Write("/f.html", "<p>hello</p>");
+    std::string srcDir = site.dir + "/";
+    struct rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    int lowest = dup(0);
+    close(lowest);
+    struct rlimit low = old;
+    low.rlim_cur = lowest + 8;
+    setrlimit(RLIMIT_NOFILE, &low);
+    std::vector<int> held;
+    for(int fd = dup(0); fd >= 0; fd = dup(0)) { held.push_back(fd); }
+    std::vector<std::string> resps;
+    {
+        HttpResponse response;
+        std::string path = "/f.html";
+        response.Init(srcDir, path, false, 200);
+        resps.push_back(Render(response));
+    }
+    {
+        // 带If-Range的范围请求：没有打开的文件就不比较校验器
+        HttpResponse response;
+        std::string path = "/f.html";
+        response.Init(srcDir, path, false, 200);
+        response.SetRange({ { 0, 3 } }, "\"x\"");
+        resps.push_back(Render(response));
+    }
+    {
+        HttpResponse response;
+        std::string path = "/f.html";
+        response.Init(srcDir, path, false, 200);
+        response.SetAcceptEncoding("gzip, br");
+        resps.push_back(Render(response));
+    }
+    for(int fd : held) { close(fd); }
+    setrlimit(RLIMIT_NOFILE, &old);
+    for(const std::string& resp : resps) {
+        assert(resp.compare(0, 13, "HTTP/1.1 500 ") == 0 && HeaderOf(resp, "ETag") == "-");
+        assert(HeaderOf(resp, "Content-Encoding") == "-");
+    }
+    printf("open failure: %zu cases answer 500 ok\n", resps.size());
+}
+
+// 用socketpair代替TCP连接驱动一个HttpConn，peer是客户端的一端；服务器一侧的读、处理、写按事件循环的顺序调用
+struct LoopbackConn {
+    int peer = -1;
+    HttpConn conn;
+    LoopbackConn() {
+        int sv[2];
+        int rc = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+        assert(rc == 0);
+        sockaddr_in addr = {};
+        conn.init(sv[0], addr);
+        peer = sv[1];
+    }
+    ~LoopbackConn() {
+        conn.Close();
+        close(peer);
+    }
+    void Send(const std::string& data) {
+        ssize_t n = write(peer, data.data(), data.size());
+        assert(n == static_cast<ssize_t>(data.size()));
+    }
+    // 读到的数据全部处理完，生成了响应时写出去，返回process的结果
+    bool Serve() {
+        int err = 0;
+        conn.read(&err);
+        bool ready = conn.process();
+        while(ready && conn.ToWriteBytes() > 0) {
+            ssize_t n = conn.write(&err);
+            assert(n > 0 || err == EAGAIN);
+        }
+        return ready;
+    }
+    // 客户端收到的数据，对端关闭时closed为true
+    std::string Receive(bool* closed = nullptr) {
+        std::string out;
+        char buf[4096];
+        ssize_t n;
+        while((n = read(peer, buf, sizeof(buf))) > 0) { out.append(buf, n); }
+        if(closed) { *closed = (n == 0); }
+        return out;
+    }
+};
+
+// 按Content-length把收到的数据切成一个个响应，返回"状态码 消息体"
+static std::vector<std::string> SplitResponses(const std::string& data) {
+    std::vector<std::string> out;
+    size_t pos = 0;
+    while(pos < data.size()) {
+        size_t end = data.find("\r\n\r\n", pos);
+        assert(end != std::string::npos);
+        std::string head = data.substr(pos, end + 4 - pos);
+        std::string len = HeaderOf(head, "Content-length");
+        size_t bodyLen = len == "-" ? 0 : std::stoul(len);
+        out.push_back(head.substr(9, 3) + " " + data.substr(end + 4, bodyLen));
+        pos = end + 4 + bodyLen;
+    }
+    return out;
+}
+
+// 流水线：一次读到的多个请求按顺序响应，跨两次读的请求接着解析，Connection: close之后的请求不再处理
+void TestPipeline() {
+    TempSite site;
+    site.Write("/a.txt", "AAAA");
+    site.Write("/b.txt", "BB");
+    std::string srcDir = site.dir + "/";
+    HttpConn::srcDir = srcDir.c_str();
+    const std::string keep = " HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    LoopbackConn lc;
+
+    lc.Send("GET /a.txt" + keep + "GET /b.txt" + keep + "GET /missing.txt" + keep + "GET /b.t");
+    bool ready = lc.Serve();
+    assert(ready && lc.conn.IsKeepAlive());
+    std::vector<std::string> got = SplitResponses(lc.Receive());
+    assert(got.size() == 3 && got[0] == "200 AAAA" && got[1] == "200 BB" && got[2].compare(0, 3, "404") == 0);
+
+    // 前半截已经在缓冲区里，后半截和后面的请求一起到
+    lc.Send("xt" + keep + "GET /a.txt HTTP/1.1\r\nConnection: close\r\n\r\nGET /b.txt" + keep);
+    ready = lc.Serve();
+    assert(ready && !lc.conn.IsKeepAlive());
+    std::string data = lc.Receive();
+    got = SplitResponses(data);
+    assert(got.size() == 2 && got[0] == "200 BB" && got[1] == "200 AAAA");
+    assert(data.find("Connection: close") != std::string::npos);
+
+    // 请求一个字节一个字节地到，响应和一次到齐时相同
+    LoopbackConn slow;
+    const std::string two = "GET /b.txt" + keep + "GET /a.txt" + keep;
+    std::string received;
+    for(char ch : two) {
+        slow.Send(std::string(1, ch));
+        slow.Serve();
+        received += slow.Receive();
+    }
+    got = SplitResponses(received);
+    assert(got.size() == 2 && got[0] == "200 BB" && got[1] == "200 AAAA");
+    HttpConn::srcDir = nullptr;
+    printf("pipeline: in-order responses, split request, stop at Connection: close ok\n");
+}
+
+// 按服务器的做法给一个连接计时：每次事件后按它当前阶段的截止时间重新定时，到期时截止时间没被顺延就关闭
+// 每interval毫秒调用一次feed(第几次)给连接发数据，返回从开始到被关闭的毫秒数，maxMs内没被关闭时返回-1
+static int RunUntilClosed(LoopbackConn& lc, const std::function<void(int)>& feed, int interval, int maxMs) {
+    TimingWheel timer;
+    const int fd = lc.conn.GetFd();
+    bool closed = false;
+    std::function<void()> expire = [&]() {
+        int64_t left = lc.conn.Deadline() - LoopClock::NowMs();
+        if(left > 0) {
+            timer.add(fd, static_cast<int>(left), expire);
+        } else {
+            lc.conn.Close();
+            closed = true;
+        }
+    };
+    auto rearm = [&]() { timer.add(fd, static_cast<int>(std::max<int64_t>(0, lc.conn.Deadline() - LoopClock::NowMs())), expire); };
+    int64_t start = LoopClock::NowMs();
+    rearm();
+    for(int step = 0; LoopClock::NowMs() - start < maxMs; step++) {
+        feed(step);
+        lc.Serve();
+        rearm();
+        for(int64_t next = LoopClock::NowMs() + interval; LoopClock::NowMs() < next; ) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            timer.tick();
+            if(closed) { return static_cast<int>(LoopClock::NowMs() - start); }
+        }
+    }
+    return -1;
+}
+
+// 各阶段的超时：首部一点点发（每次都有进展）也要在headerTimeoutMS内收完；消息体低于minRate时超时，够快时一直顺延
+void TestPhaseTimeout() {
+    int oldIdle = HttpConn::idleTimeoutMS, oldHeader = HttpConn::headerTimeoutMS;
+    int oldBody = HttpConn::bodyTimeoutMS, oldRate = HttpConn::minRate;
+    HttpConn::idleTimeoutMS = 5000;
+    HttpConn::headerTimeoutMS = 200;
+    HttpConn::bodyTimeoutMS = 200;
+    HttpConn::minRate = 1000;   // 字节/秒
+
+    // 慢速首部：每20ms一行首部，收到数据也不顺延
+    {
+        LoopbackConn lc;
+        int ms = RunUntilClosed(lc, [&lc](int step) {
+            lc.Send(step == 0 ? "GET /a.txt HTTP/1.1\r\n" : "X-Slow: " + std::to_string(step) + "\r\n");
+        }, 20, 2000);
+        bool closed = false;
+        lc.Receive(&closed);
+        assert(ms >= 180 && ms < 1000 && closed);
+        printf("phase timeout: slow header closed after %dms\n", ms);
+    }
+    // 慢速消息体：每20ms 10字节（500字节/秒，低于minRate）
+    {
+        LoopbackConn lc;
+        int ms = RunUntilClosed(lc, [&lc](int step) {
+            lc.Send(step == 0 ? "POST /x HTTP/1.1\r\nContent-Length: 100000\r\n\r\n" : std::string(10, 'b'));
+        }, 20, 3000);
+        bool closed = false;
+        lc.Receive(&closed);
+        assert(ms > 0 && ms < 3000 && closed && lc.conn.Phase() == HttpConn::BODY);
+        printf("phase timeout: slow body closed after %dms\n", ms);
+    }
+    // 消息体每20ms 100字节（5000字节/秒）：超过bodyTimeoutMS很多也不关闭
+    {
+        LoopbackConn lc;
+        int ms = RunUntilClosed(lc, [&lc](int step) {
+            lc.Send(step == 0 ? "POST /x HTTP/1.1\r\nContent-Length: 100000\r\n\r\n" : std::string(100, 'b'));
+        }, 20, 800);
+        assert(ms == -1 && lc.conn.Phase() == HttpConn::BODY);
+    }
+    // 首部发了一半就不动了
+    {
+        LoopbackConn lc;
+        int ms = RunUntilClosed(lc, [&lc](int step) {
+            if(step == 0) { lc.Send("GET /a.txt HTTP/1.1\r\nHost: x"); }
+        }, 20, 2000);
+        assert(ms >= 180 && ms < 1000);
+    }
+    HttpConn::idleTimeoutMS = oldIdle;
+    HttpConn::headerTimeoutMS = oldHeader;
+    HttpConn::bodyTimeoutMS = oldBody;
+    HttpConn::minRate = oldRate;
+}
+
+// 连接关闭后旧代数立即失效，不用等fd被复用；删掉的定时器不再触发
+void TestConnTable() {
+    ConnTable table(64);
+    uint32_t gen = table.Acquire(7);
+    assert(table.IsCurrent(7, gen));
+    table.Release(7);
+    assert(!table.IsCurrent(7, gen));
+    uint32_t next = table.Acquire(7);
+    assert(next != gen && table.IsCurrent(7, next) && !table.IsCurrent(7, gen));
+    // 交给任务期间为忙，关闭连接时清除，新连接不继承
+    table.SetBusy(7, true);
+    assert(table.IsBusy(7) && !table.IsBusy(8));
+    table.Release(7);
+    assert(!table.IsBusy(7));
+    table.SetBusy(7, true);
+    next = table.Acquire(7);
+    assert(!table.IsBusy(7));
+
+    TimingWheel timer;
+    int fired = 0;
+    timer.add(7, 0, [&fired]() { fired++; });
+    timer.add(8, 0, [&fired]() { fired += 10; });
+    timer.del(7);
+    timer.del(7);
+    assert(timer.size() == 1);
+    for(int i = 0; i < 500 && timer.size() > 0; i++) {    // 单调时钟是粗粒度的，一个节拍可能有10ms
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        timer.tick();
+    }
+    assert(fired == 10 && timer.size() == 0);
+    printf("conn table: gen changes and busy clears on release, deleted timer does not fire ok\n");
+}
+
+// io_uring后端：事件循环阻塞时其他线程的注册能把它唤醒；反复重新注册后只报告最新的一次；撤销后的fd不再报告
+void TestUringPoller() {
+    Epoller ep(64, true);
+    if(!ep.IsIoUring()) {
+        printf("uring poller: io_uring unavailable, skipped\n");
+        return;
+    }
+    int a[2], b[2];
+    int rc = pipe(a);
+    assert(rc == 0);
+    rc = pipe(b);
+    assert(rc == 0);
+    std::thread worker([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        ssize_t n = write(b[1], "x", 1);
+        assert(n == 1);
+        bool added = ep.AddFd(b[0], EPOLLIN | EPOLLONESHOT);
+        assert(added);
+    });
+    // 唤醒本身不算事件，Wait返回0，像事件循环一样再等一次时才提交新的注册
+    auto start = std::chrono::steady_clock::now();
+    int cnt = 0, waits = 0;
+    for(; cnt == 0 && waits < 3; waits++) {
+        cnt = ep.Wait(2000);
+    }
+    int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    worker.join();
+    assert(cnt == 1 && ep.GetEventFd(0) == b[0] && (ep.GetEvents(0) & EPOLLIN) && ms < 1000 && waits <= 2);
+
+    bool added = ep.AddFd(a[0], EPOLLIN | EPOLLONESHOT);
+    assert(added);
+    for(int i = 0; i < 1000; i++) {
+        bool modified = ep.ModFd(a[0], EPOLLIN | EPOLLONESHOT);
+        assert(modified);
+    }
+    ssize_t n = write(a[1], "y", 1);
+    assert(n == 1);
+    // 被撤销的poll的完成事件比完成队列还多，溢出的部分要再进一次内核才拿得到
+    for(cnt = 0, waits = 0; cnt == 0 && waits < 100; waits++) {
+        cnt = ep.Wait(1000);
+    }
+    assert(cnt == 1 && ep.GetEventFd(0) == a[0]);
+
+    bool deleted = ep.DelFd(a[0]);
+    assert(deleted);
+    deleted = ep.DelFd(b[0]);
+    assert(deleted);
+    n = write(a[1], "z", 1);
+    assert(n == 1);
+    cnt = ep.Wait(20);
+    assert(cnt == 0);
+    close(a[0]); close(a[1]); close(b[0]); close(b[1]);
+    printf("uring poller: woken by another thread after %dms, stale re-arms dropped, removed fd silent ok\n", ms);
+}
+
+// 各实现对随机数据（含分隔符、续扫的起点、行数上限、起止位置的对齐）的结果和逐字节查找一致；
+// 和逐行memchr找'\n'再找':'比较扫描普通浏览器请求和带4KB Cookie的请求的速度
+void TestLineScanner() {
+    // 逐字节的参照结果
+    auto reference = [](const char* data, size_t len, size_t from, LineScanner::Line* lines, size_t max) {
+        size_t n = 0;
+        LineScanner::Line cur = { 0, 0, LineScanner::NPOS, LineScanner::NPOS };
+        for(size_t i = 0; i < len && n < max; i++) {
+            if(data[i] == ':' && cur.colon == LineScanner::NPOS) { cur.colon = i; }
+            if(data[i] == ' ' && cur.space == LineScanner::NPOS) { cur.space = i; }
+            if(data[i] == '\n' && i >= from) {
+                cur.end = i;
+                lines[n++] = cur;
+                cur = { static_cast<uint32_t>(i + 1), 0, LineScanner::NPOS, LineScanner::NPOS };
+            }
+        }
+        return n;
+    };
+    std::mt19937 rng(7);
+    const char alphabet[] = "ab\n: \rXY";
+    LineScanner::Line expect[64], got[64];
+    std::vector<char> storage(512 + 128);
+    for(int round = 0; round < 20000; round++) {
+        // 数据前后的字节也是分隔符，对齐读取时读到它们不能影响结果
+        for(char& ch : storage) { ch = alphabet[rng() % (sizeof(alphabet) - 1)]; }
+        char* data = storage.data() + 64 + rng() % 64;
+        size_t len = rng() % 500;
+        std::string_view view(data, len);
+        size_t from = rng() % (std::min(view.find('\n'), len) + 1);  // 续扫的起点之前不能有'\n'
+        size_t max = 1 + rng() % 64;
+        size_t n = reference(data, len, from, expect, max);
+        for(LineScanner::IMPL impl : { LineScanner::SCALAR, LineScanner::SSE2, LineScanner::AVX2 }) {
+            if(impl > LineScanner::Best()) { continue; }
+            size_t cnt = LineScanner::Scan(impl, data, len, from, got, max);
+            assert(cnt == n && memcmp(expect, got, n * sizeof(LineScanner::Line)) == 0);
+        }
+    }
+
+    std::string big = "GET /index.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:1316\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n";
+    for(int i = 0; i < 8; i++) {
+        big += "Cookie: " + std::string(i, 'c') + "=" + std::string(480, 'x') + "\r\n";   // 约4KB的Cookie
+    }
+    big += "\r\n";
+    const std::string typical = "GET /css/bootstrap.min.css HTTP/1.1\r\n"
+        "Host: 127.0.0.1:1316\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: text/css,*/*;q=0.1\r\n"
+        "Referer: http://127.0.0.1:1316/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=zh-CN\r\n"
+        "\r\n";
+    // 同一段代码跑多轮取最快的一轮，减少机器上其他负载的干扰
+    auto best = [](const std::function<size_t()>& run) {
+        const int N = 20000;
+        double cost = 1e9;
+        for(int round = 0; round < 50; round++) {
+            size_t total = 0;
+            auto start = std::chrono::steady_clock::now();
+            for(int i = 0; i < N; i++) { total += run(); }
+            cost = std::min(cost, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            assert(total > 0);
+        }
+        return cost * 1e9 / N;
+    };
+    for(const std::string* req : { &typical, static_cast<const std::string*>(&big) }) {
+        // 对照：逐行memchr找'\n'再在行内找':'
+        double cost = best([req]() {
+            size_t cnt = 0;
+            const char* p = req->data();
+            const char* end = p + req->size();
+            while(const char* lf = static_cast<const char*>(memchr(p, '\n', end - p))) {
+                cnt += std::string_view(p, lf - p).find(':') != std::string_view::npos;
+                p = lf + 1;
+            }
+            return cnt;
+        });
+        printf("scan %zuB request: memchr %.0f ns", req->size(), cost);
+        for(LineScanner::IMPL impl : { LineScanner::SCALAR, LineScanner::SSE2, LineScanner::AVX2 }) {
+            if(impl > LineScanner::Best()) { continue; }
+            cost = best([req, impl]() {
+                LineScanner::Line lines[HttpRequest::SCAN_BATCH];
+                return LineScanner::Scan(impl, req->data(), req->size(), 0, lines, HttpRequest::SCAN_BATCH);
+            });
+            printf(", %s %.0f ns", LineScanner::Name(impl), cost);
+        }
+        printf("\n");
+    }
+
+    // 分几个扫描窗口才找到行尾的长行也按行长上限拒绝
+    Buffer buff;
+    buff.Append("GET / HTTP/1.1\r\nX-Long: " + std::string(HttpRequest::MAX_LINE + 2000, 'a') + "\r\n\r\n");
+    HttpRequest request;
+    HttpRequest::PARSE_RESULT ret = request.parse(buff);
+    assert(ret == HttpRequest::BAD_REQUEST);
+}
+
+// 分段缓冲区：流水线请求跨块时解析结果不变，readv读入和按块取出的内容与写入一致；对比两种模式追加大块数据的耗时
+void TestBuffer() {
+    const std::string req =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:1316\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=zh-CN\r\n"
+        "\r\n";
+    Buffer seg(0, true);
+    HttpRequest request;
+    for(int i = 0; i < 100; i++) {
+        seg.Append(req);    // 100个请求约13KB，有的行会跨块
+    }
+    for(int i = 0; i < 100; i++) {
+        HttpRequest::PARSE_RESULT ret = request.parse(seg);
+        assert(ret == HttpRequest::COMPLETE);
+        assert(request.path() == "/index.html" && request.IsKeepAlive());
+    }
+    assert(seg.ReadableBytes() == 0);
+
+    int fds[2];
+    int rc = pipe(fds);
+    assert(rc == 0);
+    std::string data(60000, '\0');
+    for(size_t i = 0; i < data.size(); i++) { data[i] = static_cast<char>(i * 131 + 7); }
+    seg.Append("head", 4);
+    ssize_t written = write(fds[1], data.data(), data.size());
+    assert(written == static_cast<ssize_t>(data.size()));
+    int err = 0;
+    ssize_t readBytes = seg.ReadFd(fds[0], &err);
+    assert(readBytes == static_cast<ssize_t>(data.size()));
+    close(fds[0]);
+    close(fds[1]);
+    size_t spans = 0;
+    seg.ForEachSpan(1, seg.ReadableBytes() - 1, [&spans](const char*, size_t) { spans++; });
+    assert(spans > 1 && seg.ContiguousBytes() < seg.ReadableBytes());
+    std::string front(seg.Pullup(10), 10);
+    assert(front == "head" + data.substr(0, 6));
+    std::string all = seg.RetrieveAllToStr();
+    assert(all == "head" + data);
+
+    const int N = 2000;
+    const std::string piece(1024, 'a');
+    for(bool segmented : { false, true }) {
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < N; i++) {
+            Buffer buff(1024, segmented);   // 从默认大小开始，连续模式要逐步扩容搬动
+            for(int j = 0; j < 256; j++) { buff.Append(piece); }    // 256KB的响应
+        }
+        double cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("buffer %s: append 256KB %.1f us\n", segmented ? "segmented" : "contiguous", cost * 1e6 / N);
+    }
+}
+
+// 缓冲区内存池：请求处理期间每个连接持有块，取完立刻还回去，空闲连接不占内存，最高值留在统计里
+void TestBufferArena() {
+    const int N = 10000;
+    const std::string req = "GET /index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    size_t base = BufferArena::GetStats().inUse;
+    std::vector<std::unique_ptr<Buffer>> conns;
+    for(int i = 0; i < N; i++) {
+        conns.emplace_back(new Buffer(0, true));
+    }
+    assert(BufferArena::GetStats().inUse == base);  // 构造时不分配
+    for(auto& buff : conns) {
+        buff->Append(req);
+    }
+    BufferArena::Stats busy = BufferArena::GetStats();
+    assert(busy.inUse == base + N * Slab::SIZE && busy.highWater >= busy.inUse);
+    for(auto& buff : conns) {
+        buff->Retrieve(buff->ReadableBytes());
+    }
+    BufferArena::Stats idle = BufferArena::GetStats();
+    assert(idle.inUse == base && idle.highWater == busy.highWater);
+    printf("arena: %d busy conns %zuKB, idle %zuKB, high water %zuKB, cached %zuKB\n", N,
+           (busy.inUse - base) >> 10, (idle.inUse - base) >> 10, idle.highWater >> 10, idle.cached >> 10);
+}
+
+// 原先的线程池：一个队列、一把锁、一个条件变量，作为工作窃取线程池的对照
+class LegacyThreadPool {
+public:
+    explicit LegacyThreadPool(int threadCount) {
+        for(int i = 0; i < threadCount; i++) {
+            threads_.emplace_back([this]() {
+                std::unique_lock<std::mutex> locker(mtx_);
+                while(true) {
+                    if(!tasks_.empty()) {
+                        auto task = std::move(tasks_.front());
+                        tasks_.pop();
+                        locker.unlock();
+                        task();
+                        locker.lock();
+                    } else if(isClosed_) {
+                        break;
+                    } else {
+                        cond_.wait(locker);
+                    }
+                }
+            });
+        }
+    }
+    ~LegacyThreadPool() {
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            isClosed_ = true;
+        }
+        cond_.notify_all();
+        for(auto& t : threads_) { t.join(); }
+    }
+    template<typename T>
+    void AddTask(T&& task) {
+        std::unique_lock<std::mutex> locker(mtx_);
+        tasks_.emplace(std::forward<T>(task));
+        cond_.notify_one();
+    }
+private:
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    bool isClosed_ = false;
+    std::queue<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+};
+
+// 一个线程（相当于Reactor）连续提交n个很小的任务，统计从提交到全部执行完的吞吐量
+template<typename Pool>
+double PoolBench(int threads, int n) {
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+    {
+        Pool pool(threads);
+        for(int i = 0; i < n; i++) {
+            pool.AddTask([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+        }
+        while(done.load() < n) { std::this_thread::yield(); }
+    }
+    return n / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 同样的任务按batch个一组用AddTasks提交，相当于一轮epoll_wait返回batch个事件
+double PoolBatchBench(int threads, int n, int batch) {
+    std::atomic<int> done(0);
+    std::vector<Task> tasks;
+    tasks.reserve(batch);
+    auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(threads);
+        for(int i = 0; i < n; ) {
+            for(; i < n && static_cast<int>(tasks.size()) < batch; i++) {
+                tasks.emplace_back([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+            }
+            pool.AddTasks(tasks.data(), tasks.size());
+            tasks.clear();
+        }
+        while(done.load() < n) { std::this_thread::yield(); }
+    }
+    return n / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void TestPoolBench() {
+    const int N = 1000000;
+    for(int threads : { 4, 8 }) {
+        printf("threadpool %d threads: single lock %.0f tasks/s, work stealing %.0f tasks/s, batches of 64 %.0f tasks/s\n",
+               threads, PoolBench<LegacyThreadPool>(threads, N), PoolBench<ThreadPool>(threads, N),
+               PoolBatchBench(threads, N, 64));
+    }
+}
+
+// 任务阻塞（相当于等数据库）时线程池扩容，空闲后缩回最少线程数
+void TestElasticPool() {
+    ThreadPool pool(2, 8, 10, 200);
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < 16; i++) {
+        pool.AddTask([&done]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            done++;
+        });
+    }
+    while(done.load() < 16) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ThreadPool::Stats busy = pool.GetStats();
+    assert(busy.grown > 0 && busy.threads > 2 && busy.executed == 16);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(600));
+    ThreadPool::Stats idle = pool.GetStats();
+    assert(idle.threads == 2 && idle.shrunk == busy.grown);
+    printf("elastic pool: 16 blocking tasks in %.0fms, grew to %d threads, shrank back to %d\n",
+           elapsed * 1000, busy.threads, idle.threads);
+}
+
+// 数据库通道的排队上限：线程被占住时最多排limit个，多的被拒绝
+void TestPoolQueueLimit() {
+    ThreadPool pool(1);
+    pool.SetQueueLimit(2);
+    std::atomic<bool> release(false);
+    std::atomic<int> done(0);
+    auto blocked = [&]() {
+        while(!release.load()) { std::this_thread::yield(); }
+        done++;
+    };
+    bool added = pool.TryAddTask(blocked);
+    assert(added);
+    while(pool.GetStats().queued > 0) { std::this_thread::yield(); }   // 等唯一的线程取走第一个任务
+    added = pool.TryAddTask(blocked) && pool.TryAddTask(blocked);
+    assert(added);
+    added = pool.TryAddTask(blocked);
+    assert(!added);
+    release = true;
+    while(done.load() < 3) { std::this_thread::yield(); }
+    ThreadPool::Stats stats = pool.GetStats();
+    assert(stats.executed == 3 && stats.rejected == 1);
+    printf("queue limit: %llu executed, %llu rejected\n",
+           static_cast<unsigned long long>(stats.executed), static_cast<unsigned long long>(stats.rejected));
+}
+
+// 模拟WebServer::OnRead_的回调形状：成员函数指针加this、reactor、client、gen
+struct FakeServer {
+    void OnRead(void* reactor, void* client, uint32_t gen) { sum += gen + (reactor != client); }
+    uint64_t sum = 0;
+};
+
+// 把绑定对象包装成任务、入队、出队、执行，比较std::function和Task的单次开销
+template<typename T>
+double TaskBench(int n) {
+    FakeServer server;
+    WorkQueue<T> queue(1024);
+    int reactor = 0, client = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++) {
+        T task(std::bind(&FakeServer::OnRead, &server, &reactor, &client, static_cast<uint32_t>(i)));
+        queue.TryPush(task);
+        T out;
+        queue.TryPop(out);
+        out();
+    }
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    assert(server.sum == static_cast<uint64_t>(n) * (n - 1) / 2 + n);
+    return t * 1e9 / n;
+}
+
+void TestTaskBench() {
+    const int N = 1000000;
+    printf("task handoff: std::function %.1f ns, Task %.1f ns\n",
+           TaskBench<std::function<void()>>(N), TaskBench<Task>(N));
+}
+
+// 对每种定时器：添加n个60s左右的定时器，随机刷新n次（相当于每个连接收到一次请求），删除一半，再让n个短定时器到期
+template<typename Timer>
+void TimerBench(const char* name, int n) {
+    std::mt19937 rng(n);
+    std::vector<int> timeouts(n), ids(n);
+    for(int i = 0; i < n; i++) {
+        timeouts[i] = 30000 + rng() % 30000;
+        ids[i] = rng() % n;
+    }
+    int fired = 0;
+    auto cb = [&fired]() { fired++; };
+    double t[4];
+    {
+        Timer timer;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) { timer.add(i, timeouts[i], cb); }
+        t[0] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < n; i++) { timer.adjust(ids[i], timeouts[i]); }
+        t[1] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < n; i += 2) { timer.doWork(i); }
+        t[2] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    {
+        Timer timer;
+        for(int i = 0; i < n; i++) { timer.add(i, rng() % 10, cb); }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        fired = 0;
+        auto start = std::chrono::steady_clock::now();
+        timer.tick();
+        t[3] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        assert(fired == n && timer.GetNextTick() == -1);
+    }
+    printf("%-12s n=%-8d add %6.1f ns  adjust %6.1f ns  cancel %6.1f ns  expire %6.1f ns\n",
+           name, n, t[0] * 1e9 / n, t[1] * 1e9 / n, t[2] * 2e9 / n, t[3] * 1e9 / n);
+}
+
+void TestTimerBench() {
+    for(int n : { 10000, 100000, 1000000 }) {
+        TimerBench<HeapTimer>("HeapTimer", n);
+        TimerBench<TimingWheel>("TimingWheel", n);
+    }
+}
+
+// 同一节拍内连续读墙上时间，微秒数在本线程内严格递增；放在最后，Update之后缓存只由事件循环刷新
+void TestLoopClock() {
+    LoopClock::Update();
+    long prev = -1;
+    time_t sec = LoopClock::Wall().sec;
+    for(int i = 0; i < 1000; i++) {
+        const LoopClock::WallTime& now = LoopClock::Wall();
+        long us = static_cast<long>(now.sec - sec) * 1000000 + now.usec;
+        assert(us > prev && !now.httpDate.empty());
+        prev = us;
+    }
+    printf("loop clock: 1000 reads in one tick, stamps strictly increasing\n");
+}
+
 int main() {
+    TestParserBench();
+    TestRequestBody();
+    TestMultipart();
+    TestContentEncoding();
+    TestRange();
+    TestConditional();
+    TestOpenFailure();
+    TestPipeline();
+    TestPhaseTimeout();
+    TestConnTable();
+    TestUringPoller();
+    TestLineScanner();
+    TestBuffer();
+    TestBufferArena();
+    TestTimerBench();
+    TestPoolBench();
+    TestTaskBench();
+    TestElasticPool();
+    TestPoolQueueLimit();
     TestLog();
     TestThreadPool();
+    TestLoopClock();
 }
\ No newline at end of file